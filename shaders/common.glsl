@@ -22,6 +22,7 @@
 
 const uint NUM_BOUNCES = 3;
 const uint MAX_LIGHTS = 512;
+const uint MAX_SVO_MODELS = 256;
 const uint KIND_TRIANGLE = 0;
 const uint KIND_VOXEL = 1;
 const uint KIND_VOLUMETRIC = 2;
@@ -35,6 +36,7 @@ const float SURFACE_OFFSET = 0.0001;
 const float FLOAT_MAX = 3.402823466e+38;
 const float FLOAT_MIN = 1.175494351e-38;
 const float FAR_AWAY = 1000.0;
+const float VOLUME_EPSILON = 0.001;
 
 const vec3 voxel_normals[6] = vec3[6](
 				      vec3(-1.0, 0.0, 0.0),
@@ -65,18 +67,24 @@ struct hit_payload {
     vec3 volumetric_back_position;
     float volumetric_dls_weight;
     vec3 volumetric_dls_back_position;
+
+    // Set by the ray generation shader before tracing, to pick texture LODs.
+    float cone_width;
+    float cone_spread;
 };
 
 struct obj_desc {
     uint64_t vertex_address;
     uint64_t index_address;
-    uint64_t model_id;
+    uint model_id;
+    uint narrow_indices;
+    uint texture_ids[3];
 };
 
 struct vertex {
     vec3 position;
-    vec3 normal;
-    vec2 texcoord;
+    uint packed_normal;
+    uint packed_texcoord;
 };
 #endif
 
@@ -104,16 +112,7 @@ struct pixel_sample {
 };
 
 layout (push_constant) uniform PushConstants {
-    uint current_frame;
-    float alpha_temporal;
-    float alpha_taa;
-    float sigma_normal;
-    float sigma_position;
-    float sigma_luminance;
     uint filter_iter;
-    uint num_filter_iters;
-    uint temporal;
-    uint taa;
 };
 
 layout(set = 0, binding = 0) uniform lights_uniform {
@@ -141,8 +140,23 @@ layout(set = 0, binding = 1) uniform projection_uniform {
     vec3 ray_trace2_view_dir;
     vec3 ray_trace2_basis_right;
     vec3 ray_trace2_basis_up;
+    // Must match RenderContext::FRAME_CONSTANTS_OFFSET.
+    layout(offset = 832) uint current_frame;
+    float alpha_temporal;
+    float alpha_taa;
+    float sigma_normal;
+    float sigma_position;
+    float sigma_luminance;
+    uint num_filter_iters;
+    uint temporal;
+    uint taa;
 };
 
+// Each texture has one descriptor per frame in flight, see
+// update_streamed_texture_descriptors.
+#ifndef FRAMES_IN_FLIGHT
+#error "FRAMES_IN_FLIGHT must be defined."
+#endif
 layout(set = 0, binding = 2) uniform sampler2D textures[];
 
 #ifdef RAY_TRACING
@@ -197,11 +211,14 @@ layout(set = 1, binding = 36) uniform sampler2D taa2_texture;
 
 layout(set = 1, binding = 37) buffer palette_buf { uint p[]; };
 
-layout(set = 1, binding = 38, r8) uniform readonly image3D volumes[];
+layout(set = 1, binding = 38) buffer svo_buf { uint svo_roots[MAX_SVO_MODELS]; uint svo_nodes[]; };
+
+layout(set = 1, binding = 39) uniform sampler3D volumes[];
 
 #ifdef RAY_TRACING
 layout(buffer_reference, scalar) buffer vertices_buf { vertex v[]; };
 layout(buffer_reference, scalar) buffer indices_buf { uvec3 i[]; };
+layout(buffer_reference, scalar) buffer narrow_indices_buf { uint i[]; };
 #endif
 
 uint hash(uint x) {
@@ -425,6 +442,85 @@ aabb_intersect_result hit_aabb(const vec3 minimum, const vec3 maximum, const vec
 }
 
 #ifdef RAY_TRACING
+struct volume_march_result {
+    bool hit;
+    ivec3 voxel;
+};
+
+// Walks a dense volume front to back, starting at object space ray time t_enter.
+// Mips above 0 are max-reduced occupancy, so an empty cell at any level is
+// skipped in one step; occupied cells are refined a level at a time, and the
+// walk climbs back up a level after each skip.
+volume_march_result march_volume(uint volume_id, vec3 obj_ray_pos, vec3 obj_ray_dir, float t_enter) {
+    volume_march_result result;
+    result.hit = false;
+
+    ivec3 volume_size = textureSize(volumes[volume_id], 0);
+    int top_level = textureQueryLevels(volumes[volume_id]) - 1;
+    vec3 ray_pos = obj_ray_pos * vec3(volume_size);
+    vec3 ray_dir = obj_ray_dir * vec3(volume_size);
+    vec3 ray_inv_dir = 1.0 / mix(ray_dir, vec3(FLOAT_MIN), equal(ray_dir, vec3(0.0)));
+    vec3 ray_step = step(vec3(0.0), ray_dir);
+    vec3 ray_point = clamp(ray_pos + ray_dir * t_enter, vec3(0.0), vec3(volume_size) - VOLUME_EPSILON);
+
+    int level = top_level;
+    uint max_steps = 3 * uint(volume_size.x + volume_size.y + volume_size.z);
+    for (uint steps = 0; steps < max_steps; ++steps) {
+	ivec3 voxel = ivec3(ray_point);
+	ivec3 level_size = textureSize(volumes[volume_id], level);
+	ivec3 cell = min(voxel >> level, level_size - 1);
+	if (texelFetch(volumes[volume_id], cell, level).r > 0.0) {
+	    if (level == 0) {
+		result.hit = true;
+		result.voxel = voxel;
+		return result;
+	    }
+	    --level;
+	    continue;
+	}
+
+	// The last cell of a level also covers the remainder of odd extents.
+	vec3 cell_lo = vec3(cell << level);
+	vec3 cell_hi = vec3(mix((cell + 1) << level, volume_size, equal(cell, level_size - 1)));
+	vec3 exit_planes = mix(cell_lo, cell_hi, ray_step);
+	vec3 t_exit = (exit_planes - ray_pos) * ray_inv_dir;
+	float t = min(t_exit.x, min(t_exit.y, t_exit.z));
+	ray_point = mix(ray_pos + ray_dir * t, exit_planes + sign(ray_dir) * VOLUME_EPSILON, lessThanEqual(t_exit, vec3(t)));
+	if (any(lessThan(ray_point, vec3(0.0))) || any(greaterThanEqual(ray_point, vec3(volume_size)))) {
+	    return result;
+	}
+	level = min(level + 1, top_level);
+    }
+    return result;
+}
+
+// 16 bit indices are read as pairs packed into words, so no 16 bit storage
+// feature is needed.
+uvec3 fetch_triangle_indices(obj_desc obj, uint primitive_id) {
+    if (obj.narrow_indices != 0) {
+	narrow_indices_buf indices = narrow_indices_buf(obj.index_address);
+	uvec3 halves = 3 * primitive_id + uvec3(0, 1, 2);
+	uvec3 words = uvec3(indices.i[halves.x >> 1], indices.i[halves.y >> 1], indices.i[halves.z >> 1]);
+	return (words >> ((halves & 1) * 16)) & 0xFFFF;
+    } else {
+	indices_buf indices = indices_buf(obj.index_address);
+	return indices.i[primitive_id];
+    }
+}
+
+vec3 vertex_normal(vertex v) {
+    vec2 oct = unpackSnorm2x16(v.packed_normal);
+    vec3 n = vec3(oct, 1.0 - abs(oct.x) - abs(oct.y));
+    if (n.z < 0.0) {
+	n.xy = (1.0 - abs(n.yx)) * mix(vec2(-1.0), vec2(1.0), greaterThanEqual(n.xy, vec2(0.0)));
+    }
+    return normalize(n);
+}
+
+vec2 vertex_texcoord(vertex v) {
+    return unpackHalf2x16(v.packed_texcoord);
+}
+
 hit_payload create_miss(vec3 origin, vec3 direction) {
     hit_payload prd;
     prd.albedo = vec3(1.0);
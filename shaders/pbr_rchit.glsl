@@ -24,12 +24,17 @@ layout(location = 0) rayPayloadInEXT hit_payload prd;
 
 hitAttributeEXT vec2 attribs;
 
+vec4 sample_texture(uint texture_id, vec2 texcoord, float lod) {
+    const uint descriptor = texture_id * FRAMES_IN_FLIGHT + current_frame % FRAMES_IN_FLIGHT;
+    vec2 texture_size = vec2(textureSize(textures[descriptor], 0));
+    return textureLod(textures[descriptor], texcoord, lod + 0.5 * log2(texture_size.x * texture_size.y));
+}
+
 void main() {
     obj_desc obj = objects.i[gl_InstanceCustomIndexEXT];
     vertices_buf vertices = vertices_buf(obj.vertex_address);
-    indices_buf indices = indices_buf(obj.index_address);
 
-    uvec3 index = indices.i[gl_PrimitiveID];
+    uvec3 index = fetch_triangle_indices(obj, uint(gl_PrimitiveID));
 
     vertex v0 = vertices.v[index.x];
     vertex v1 = vertices.v[index.y];
@@ -40,22 +45,35 @@ void main() {
     vec3 obj_position = v0.position * barycentrics.x + v1.position * barycentrics.y + v2.position * barycentrics.z;
     vec3 world_position = vec3(gl_ObjectToWorldEXT * vec4(obj_position, 1.0));
 
-    vec3 obj_flat_normal = v0.normal * barycentrics.x + v1.normal * barycentrics.y + v2.normal * barycentrics.z;
+    vec3 obj_flat_normal = vertex_normal(v0) * barycentrics.x + vertex_normal(v1) * barycentrics.y + vertex_normal(v2) * barycentrics.z;
     vec3 world_flat_normal = normalize(vec3(obj_flat_normal * gl_WorldToObjectEXT));
 
-    vec2 texcoord = v0.texcoord * barycentrics.x + v1.texcoord * barycentrics.y + v2.texcoord * barycentrics.z;
-  
-    uint texture_base_id = uint(obj.model_id) * 4;
-    vec3 albedo = texture(textures[texture_base_id], texcoord).xyz;
-    vec3 bump_normal = texture(textures[texture_base_id + 1], texcoord).xyz;
-    float roughness = texture(textures[texture_base_id + 2], texcoord).x;
-    float metallicity = texture(textures[texture_base_id + 3], texcoord).x;
+    vec2 texcoord0 = vertex_texcoord(v0);
+    vec2 texcoord1 = vertex_texcoord(v1);
+    vec2 texcoord2 = vertex_texcoord(v2);
+    vec2 texcoord = texcoord0 * barycentrics.x + texcoord1 * barycentrics.y + texcoord2 * barycentrics.z;
 
-    vec3 N = world_flat_normal;
     vec3 triangle_edge1 = v1.position - v0.position;
     vec3 triangle_edge2 = v2.position - v0.position;
-    vec2 delta_texcoord1 = v1.texcoord - v0.texcoord;
-    vec2 delta_texcoord2 = v2.texcoord - v0.texcoord;
+    vec2 delta_texcoord1 = texcoord1 - texcoord0;
+    vec2 delta_texcoord2 = texcoord2 - texcoord0;
+
+    // Ray cone LOD: the cone's footprint on the triangle, measured against the
+    // triangle's texel density. The texture's own size is added per sample.
+    float world_area = length(cross(vec3(gl_ObjectToWorldEXT * vec4(triangle_edge1, 0.0)), vec3(gl_ObjectToWorldEXT * vec4(triangle_edge2, 0.0))));
+    float texcoord_area = abs(delta_texcoord1.x * delta_texcoord2.y - delta_texcoord2.x * delta_texcoord1.y);
+    float footprint = (prd.cone_width + prd.cone_spread * gl_HitTEXT) / max(abs(dot(gl_WorldRayDirectionEXT, world_flat_normal)), 0.01);
+    float lod = 0.5 * log2(max(texcoord_area, 1e-12) / max(world_area, 1e-12)) + log2(max(footprint, 1e-12));
+  
+    vec3 albedo = sample_texture(obj.texture_ids[0], texcoord, lod).xyz;
+    // Normal maps may be baked to two channels, so always rebuild z.
+    vec2 bump_normal_xy = sample_texture(obj.texture_ids[1], texcoord, lod).xy * 2.0 - 1.0;
+    vec3 bump_normal = vec3(bump_normal_xy, sqrt(max(1.0 - dot(bump_normal_xy, bump_normal_xy), 0.0)));
+    vec2 material = sample_texture(obj.texture_ids[2], texcoord, lod).xy;
+    float roughness = material.x;
+    float metallicity = material.y;
+
+    vec3 N = world_flat_normal;
     float det = 1.0 / (delta_texcoord1.x * delta_texcoord2.y - delta_texcoord2.x * delta_texcoord1.y);
     vec3 obj_T = vec3(
 		      det * (delta_texcoord2.y * triangle_edge1.x - delta_texcoord1.y * triangle_edge2.x),
@@ -66,7 +84,7 @@ void main() {
     vec3 B = cross(N, T);
     mat3 TBN = mat3(T, B, N);
 
-    vec3 normal = normalize(TBN * (bump_normal * 2.0 - 1.0));
+    vec3 normal = normalize(TBN * bump_normal);
 
     prd.albedo = albedo;
     prd.normal = normal;
@@ -76,5 +94,5 @@ void main() {
     prd.hit_position = world_position;
     prd.direct_emittance = 0.0;
     prd.model_kind = KIND_TRIANGLE;
-    prd.model_id = uint(obj.model_id);
+    prd.model_id = obj.model_id;
 }
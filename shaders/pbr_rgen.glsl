@@ -150,11 +150,20 @@ void main() {
     vec3 ray_pos = camera_position;
     vec3 ray_dir = normalize((centered_inverse_camera * inverse_jittered_perspective * vec4(device_coord, 0.0, 1.0)).xyz);
 
+    // Camera rays start as cones spanning one pixel. Each bounce widens the
+    // cone by its lobe, so secondary hits read from small mips.
+    vec2 neighbor_device_coord = pixel_coord_to_device_coord(vec2(gl_LaunchIDEXT.xy) + vec2(0.0, 1.0));
+    vec3 neighbor_ray_dir = normalize((centered_inverse_camera * inverse_jittered_perspective * vec4(neighbor_device_coord, 0.0, 1.0)).xyz);
+    float cone_width = 0.0;
+    float cone_spread = length(neighbor_ray_dir - ray_dir);
+
     bool found_first_hit = false;
     bool found_first_non_volumetric_hit = false;
     hit_payload first_hit;
     vec3 first_non_volumetric_hit_position = vec3(0.0);
     for (uint hit_num = 0; hit_num < NUM_BOUNCES && any(greaterThan(weight, vec3(WEIGHT_CUTOFF))); ++hit_num) {
+	prd.cone_width = cone_width;
+	prd.cone_spread = cone_spread;
 	traceRayEXT(tlas, gl_RayFlagsOpaqueEXT, 0xFF, 0, 0, 0, ray_pos, 0.001, ray_dir, FAR_AWAY, 0);
 	hit_payload indirect_prd = prd;
 
@@ -176,10 +185,14 @@ void main() {
 	}
 
 	if (indirect_prd.model_kind != KIND_VOLUMETRIC) {
+	    cone_width += cone_spread * distance(ray_pos, indirect_prd.hit_position);
+	    cone_spread += indirect_prd.roughness * indirect_prd.roughness;
 	    ray_pos = indirect_prd.hit_position + indirect_prd.flat_normal * SURFACE_OFFSET;
 	    ray_sample direct_sample = sample_light_sources(slice_2_from_4(random, hit_num), ray_pos, indirect_prd.normal);
 	    if (direct_sample.drawn_weight > 0.0) {
 		vec3 dls_weight = weight;
+		prd.cone_width = cone_width;
+		prd.cone_spread = cone_spread;
 		traceRayEXT(tlas, gl_RayFlagsOpaqueEXT, 0xFF, 0, 0, 0, ray_pos, 0.001, direct_sample.drawn_sample, FAR_AWAY, 0);
 		while (prd.model_kind == KIND_VOLUMETRIC && any(greaterThan(dls_weight, vec3(WEIGHT_CUTOFF)))) {
 		    dls_weight *= prd.volumetric_weight;
@@ -202,6 +215,8 @@ void main() {
 	    vec3 direct_ray_pos = indirect_prd.volumetric_dls_back_position;
 
 	    ray_sample direct_sample = sample_light_sources(slice_2_from_4(random, hit_num), direct_ray_pos, vec3(0.0));
+	    prd.cone_width = cone_width;
+	    prd.cone_spread = cone_spread;
 	    traceRayEXT(tlas, gl_RayFlagsOpaqueEXT, 0xFF, 0, 0, 0, direct_ray_pos, 0.001, direct_sample.drawn_sample, FAR_AWAY, 0);
 	    while (prd.model_kind == KIND_VOLUMETRIC && any(greaterThan(dls_weight, vec3(WEIGHT_CUTOFF)))) {
 		dls_weight *= prd.volumetric_weight;
@@ -209,6 +224,7 @@ void main() {
 	    }
 	    outward_radiance += prd.direct_emittance * dls_weight * direct_sample.drawn_weight;
 	    
+	    cone_width += cone_spread * distance(ray_pos, indirect_prd.volumetric_back_position);
 	    ray_pos = indirect_prd.volumetric_back_position;
 	    weight *= indirect_prd.volumetric_weight;
 	}
@@ -0,0 +1,123 @@
+/*
+ * This file is part of trace.
+ * trace is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ * trace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with trace. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#version 460
+#pragma shader_stage(intersect)
+#extension GL_GOOGLE_include_directive : enable
+
+#define RAY_TRACING
+#include "common.glsl"
+
+hitAttributeEXT uint svo_leaf_data;
+
+// MAX_SVO_DEPTH comes from the Makefile, which also hands it to the loader.
+#ifndef MAX_SVO_DEPTH
+#error "MAX_SVO_DEPTH must be defined."
+#endif
+const float SVO_GRID_WIDTH = float(1u << MAX_SVO_DEPTH);
+// Every step leaves at least one cell of the finest grid, and a ray crosses at most
+// 3 * 2^depth of those, so this bound never cuts off a hit.
+const uint MAX_SVO_STEPS = 3u << MAX_SVO_DEPTH;
+const float SVO_EPSILON = 0.00001;
+
+void main() {
+    uint svo_id = gl_InstanceCustomIndexEXT;
+    uint base = svo_roots[svo_id];
+    
+    vec3 obj_ray_pos = gl_WorldToObjectEXT * vec4(gl_WorldRayOriginEXT, 1.0);
+    vec3 obj_ray_dir = gl_WorldToObjectEXT * vec4(gl_WorldRayDirectionEXT, 0.0);
+
+    aabb_intersect_result r = hit_aabb(vec3(0.0), vec3(1.0), obj_ray_pos, obj_ray_dir);
+    if (r.t == -FAR_AWAY) {
+	return;
+    }
+
+    // The voxelizer's Morton x axis maps to object space z (and vice versa), matching
+    // how .vox models are laid out in their volumes.
+    vec3 svo_ray_pos = obj_ray_pos.zyx;
+    vec3 svo_ray_dir = obj_ray_dir.zyx;
+    vec3 svo_ray_inv_dir = 1.0 / mix(svo_ray_dir, vec3(FLOAT_MIN), equal(svo_ray_dir, vec3(0.0)));
+    vec3 svo_ray_step = step(vec3(0.0), svo_ray_dir);
+    vec3 svo_ray_point = clamp(svo_ray_pos + svo_ray_dir * max(r.t, 0.0), vec3(0.0), vec3(1.0 - SVO_EPSILON));
+
+    // Points are tracked as cells of the finest grid. node_stack[d] is the node at depth d
+    // containing the current point, so after stepping past an empty octant traversal
+    // resumes from the deepest node still containing the new point instead of the root.
+    // A filled leaf is a hit, and an empty octant of any size is skipped in one step by
+    // moving the point just past the octant's exit face.
+    uint node_stack[MAX_SVO_DEPTH];
+    node_stack[0] = 0;
+    uint depth = 0;
+    uvec3 cell = uvec3(svo_ray_point * SVO_GRID_WIDTH);
+    for (uint steps = 0; steps < MAX_SVO_STEPS; ++steps) {
+	uint node = node_stack[depth];
+	bool hit = false;
+	for (; depth < MAX_SVO_DEPTH; ++depth) {
+	    uvec3 upper = (cell >> (MAX_SVO_DEPTH - 1u - depth)) & 1u;
+	    uint k = 7u - (upper.x | (upper.y << 1) | (upper.z << 2));
+
+	    uint word = svo_nodes[base + node];
+	    uint valid_mask = (word >> 16) & 0xFFu;
+	    uint leaf_mask = word >> 24;
+	    if ((valid_mask & (1u << k)) == 0) {
+		break;
+	    }
+
+	    uint child_pointer = word & 0x7FFFu;
+	    if ((word & 0x8000u) != 0) {
+		child_pointer = svo_nodes[base + node + child_pointer];
+	    }
+	    uint child = node + child_pointer + uint(bitCount(valid_mask & ((1u << k) - 1u)));
+	    if ((leaf_mask & (1u << k)) != 0) {
+		svo_leaf_data = svo_nodes[base + child];
+		hit = svo_leaf_data != 0u;
+		break;
+	    }
+	    node = child;
+	    if (depth + 1u < MAX_SVO_DEPTH) {
+		node_stack[depth + 1u] = child;
+	    }
+	}
+
+	// The octant the loop stopped in is a child of node_stack[depth].
+	uint octant_shift = MAX_SVO_DEPTH - 1u - min(depth, MAX_SVO_DEPTH - 1u);
+	float size = float(1u << octant_shift) / SVO_GRID_WIDTH;
+	vec3 lo = vec3((cell >> octant_shift) << octant_shift) / SVO_GRID_WIDTH;
+
+	if (hit) {
+	    r = hit_aabb(lo.zyx, (lo + size).zyx, obj_ray_pos, obj_ray_dir);
+	    vec3 obj_ray_voxel_intersect_point = obj_ray_pos + obj_ray_dir * max(r.t, 0.0);
+	    float intersect_time = length(gl_ObjectToWorldEXT * vec4(obj_ray_voxel_intersect_point, 1.0) - gl_ObjectToWorldEXT * vec4(obj_ray_pos, 1.0));
+	    reportIntersectionEXT(intersect_time, r.k);
+	    return;
+	}
+
+	vec3 exit_planes = lo + svo_ray_step * size;
+	vec3 t_exit = (exit_planes - svo_ray_pos) * svo_ray_inv_dir;
+	float t = min(t_exit.x, min(t_exit.y, t_exit.z));
+	svo_ray_point = mix(svo_ray_pos + svo_ray_dir * t, exit_planes + sign(svo_ray_dir) * SVO_EPSILON, lessThanEqual(t_exit, vec3(t)));
+	if (any(lessThan(svo_ray_point, vec3(0.0))) || any(greaterThanEqual(svo_ray_point, vec3(1.0)))) {
+	    return;
+	}
+
+	// Pop to the deepest node containing both the old and the new cell: the highest
+	// bit where the cells differ is the level where their paths through the tree split.
+	uvec3 next_cell = uvec3(svo_ray_point * SVO_GRID_WIDTH);
+	uvec3 diff = cell ^ next_cell;
+	int split_bit = findMSB(diff.x | diff.y | diff.z);
+	cell = next_cell;
+	depth = min(depth, MAX_SVO_DEPTH - 1u - uint(max(split_bit, 0)));
+    }
+}
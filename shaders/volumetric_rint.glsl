@@ -28,6 +28,10 @@ void main() {
 
     aabb_intersect_result r = hit_aabb(vec3(0.0), vec3(1.0), obj_ray_pos, obj_ray_dir);
     if (r.t != -FAR_AWAY) {
-	reportIntersectionEXT(r.t, r.k);
+	// Rays that only cross empty space in the volume never report a hit.
+	volume_march_result march = march_volume(volume_id, obj_ray_pos, obj_ray_dir, max(r.t, 0.0));
+	if (march.hit) {
+	    reportIntersectionEXT(r.t, r.k);
+	}
     }
 }
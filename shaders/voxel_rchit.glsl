@@ -28,8 +28,8 @@ void main() {
     vec3 normal = normalize((voxel_normals[gl_HitKindEXT] * gl_WorldToObjectEXT).xyz);
 
     vec3 voxel_sample_pos = gl_WorldToObjectEXT * vec4(world_ray_pos, 1.0);
-    ivec3 volume_load_pos = ivec3(voxel_sample_pos * vec3(imageSize(volumes[gl_InstanceCustomIndexEXT])) - 0.5 * voxel_normals[gl_HitKindEXT]);
-    uint palette = uint(256.0 * imageLoad(volumes[gl_InstanceCustomIndexEXT], volume_load_pos).r);
+    ivec3 volume_load_pos = ivec3(voxel_sample_pos * vec3(textureSize(volumes[gl_InstanceCustomIndexEXT], 0)) - 0.5 * voxel_normals[gl_HitKindEXT]);
+    uint palette = uint(256.0 * texelFetch(volumes[gl_InstanceCustomIndexEXT], volume_load_pos, 0).r);
     
     uint palette_lookup = p[gl_InstanceCustomIndexEXT * 256 + palette];
     uint palette_r = palette_lookup & 0xFF;
@@ -28,31 +28,13 @@ void main() {
 
     aabb_intersect_result r = hit_aabb(vec3(0.0), vec3(1.0), obj_ray_pos, obj_ray_dir);
     if (r.t != -FAR_AWAY) {
-	ivec3 volume_size = imageSize(volumes[volume_id]);
-	vec3 obj_ray_intersect_point = (obj_ray_pos + obj_ray_dir * max(r.t, 0.0)) * volume_size;
-	ivec3 obj_ray_voxel = ivec3(min(obj_ray_intersect_point, volume_size - 1));
-	ivec3 obj_ray_step = ivec3(sign(obj_ray_dir));
-	vec3 obj_ray_delta = abs(vec3(length(obj_ray_dir)) / obj_ray_dir);
-	vec3 obj_side_dist = (sign(obj_ray_dir) * (vec3(obj_ray_voxel) - obj_ray_intersect_point) + (sign(obj_ray_dir) * 0.5) + 0.5) * obj_ray_delta;
-
-	uint steps = 0;
-	uint max_steps = uint(volume_size.x) + uint(volume_size.y) + uint(volume_size.z);
-	while (steps < max_steps && all(greaterThanEqual(obj_ray_voxel, ivec3(0))) && all(lessThan(obj_ray_voxel, volume_size))) {
-	    float palette = imageLoad(volumes[volume_id], obj_ray_voxel).r;
-	    
-	    if (palette > 0.0) {
-		r = hit_aabb(vec3(obj_ray_voxel) / volume_size, vec3(obj_ray_voxel + 1) / volume_size, obj_ray_pos, obj_ray_dir);
-		vec3 obj_ray_voxel_intersect_point = obj_ray_pos + obj_ray_dir * max(r.t, 0.0);
-		float intersect_time = length(gl_ObjectToWorldEXT * vec4(obj_ray_voxel_intersect_point, 1.0) - gl_ObjectToWorldEXT * vec4(obj_ray_pos, 1.0));
-		reportIntersectionEXT(intersect_time, r.k);
-		return;
-	    }
-
-	    bvec3 mask = lessThanEqual(obj_side_dist.xyz, min(obj_side_dist.yzx, obj_side_dist.zxy));
-	    
-	    obj_side_dist += vec3(mask) * obj_ray_delta;
-	    obj_ray_voxel += ivec3(mask) * obj_ray_step;
-	    ++steps;
+	volume_march_result march = march_volume(volume_id, obj_ray_pos, obj_ray_dir, max(r.t, 0.0));
+	if (march.hit) {
+	    vec3 volume_size = vec3(textureSize(volumes[volume_id], 0));
+	    r = hit_aabb(vec3(march.voxel) / volume_size, vec3(march.voxel + 1) / volume_size, obj_ray_pos, obj_ray_dir);
+	    vec3 obj_ray_voxel_intersect_point = obj_ray_pos + obj_ray_dir * max(r.t, 0.0);
+	    float intersect_time = length(gl_ObjectToWorldEXT * vec4(obj_ray_voxel_intersect_point, 1.0) - gl_ObjectToWorldEXT * vec4(obj_ray_pos, 1.0));
+	    reportIntersectionEXT(intersect_time, r.k);
 	}
     }
 }
@@ -12,9 +12,12 @@
  * along with trace. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+
 #include "Tracy.hpp"
 
 #include "context.h"
+#include "texture.h"
 
 auto RenderContext::create_allocator() noexcept -> void {
     ZoneScoped;
@@ -152,7 +155,7 @@ auto RenderContext::create_image(VkImageCreateFlags flags, VkFormat format, VkEx
     VmaAllocation allocation;
     
     ASSERT(vmaCreateImage(allocator, &create_info, &alloc_info, &image, &allocation, nullptr), "Unable to create image.");
-    return {image, allocation, extent};
+    return {image, allocation, extent, format, mip_levels};
 }
 
 auto RenderContext::create_volume(VkImageCreateFlags flags, VkFormat format, VkExtent3D extent, uint32_t mip_levels, uint32_t array_layers, VkImageUsageFlags usage, VkMemoryPropertyFlags memory_flags, VmaAllocationCreateFlags vma_flags, const char *name) noexcept -> Volume {
@@ -188,7 +191,7 @@ auto RenderContext::create_volume(VkImageCreateFlags flags, VkFormat format, VkE
     VmaAllocation allocation;
     
     ASSERT(vmaCreateImage(allocator, &create_info, &alloc_info, &image, &allocation, nullptr), "Unable to create image.");
-    return {image, allocation, extent};
+    return {image, allocation, extent, mip_levels};
 }
 
 auto RenderContext::create_image_view(VkImage image, VkFormat format, VkImageSubresourceRange subresource_range) noexcept -> VkImageView {
@@ -271,26 +274,29 @@ auto RenderContext::cleanup_image3d_view(VkImageView view) noexcept -> void {
     vkDestroyImageView(device, view, NULL);
 }
 
-auto RenderContext::create_ringbuffer() noexcept -> RingBuffer {
+auto RenderContext::create_ringbuffer(VkQueue ring_queue, VkCommandPool ring_command_pool, uint32_t ring_queue_family) noexcept -> RingBuffer {
     ZoneScoped;
-    return {};
+    RingBuffer ring_buffer {};
+    ring_buffer.queue = ring_queue;
+    ring_buffer.command_pool = ring_command_pool;
+    ring_buffer.queue_family = ring_queue_family;
+    ring_buffer.timeline = create_timeline_semaphore(0);
+    return ring_buffer;
 }
 
 auto RenderContext::cleanup_ringbuffer(RingBuffer &ring_buffer) noexcept -> void {
     ZoneScoped;
-    for (auto &element : ring_buffer.elements) {
-	cleanup_buffer(element.buffer);
-	vkDestroySemaphore(device, element.semaphore, NULL);
-    }
-    ring_buffer.elements.clear();
-    for (auto [_, semaphore] : ring_buffer.upload_buffer_semaphores) {
-	vkDestroySemaphore(device, semaphore, NULL);
+    for (auto &chunk : ring_buffer.chunks) {
+	vmaUnmapMemory(allocator, chunk.buffer.allocation);
+	cleanup_buffer(chunk.buffer);
     }
-    ring_buffer.upload_buffer_semaphores.clear();
-    for (auto [_, semaphore] : ring_buffer.upload_image_semaphores) {
-	vkDestroySemaphore(device, semaphore, NULL);
-    }
-    ring_buffer.upload_image_semaphores.clear();
+    ring_buffer.chunks.clear();
+    for (auto &batch : ring_buffer.batches)
+	vkFreeCommandBuffers(device, ring_buffer.command_pool, 1, &batch.command_buffer);
+    ring_buffer.batches.clear();
+    ring_buffer.current_batch = RingBuffer::NO_BATCH;
+    ring_buffer.pending_acquires.clear();
+    vkDestroySemaphore(device, ring_buffer.timeline, NULL);
 }
 
 static inline auto round_up_p2(std::size_t v) noexcept -> std::size_t {
@@ -310,101 +316,180 @@ auto RenderContext::ringbuffer_claim_buffer(RingBuffer &ring_buffer, std::size_t
     ring_buffer.last_copy_size = size;
     if (size == 0)
 	return NULL;
-    for (ring_buffer.last_id = 0; ring_buffer.last_id < ring_buffer.elements.size(); ++ring_buffer.last_id) {
-	const auto &element = ring_buffer.elements[ring_buffer.last_id];
-	if (element.size >= size && element.occupied == RingBuffer::NOT_OCCUPIED) {
-	    break;
+
+    auto fits = [size](const RingBuffer::Chunk &chunk) { return chunk.offset + size <= chunk.buffer.size; };
+    if (ring_buffer.chunks.empty() || !fits(ring_buffer.chunks[ring_buffer.current_chunk])) {
+	// Move on to a chunk the GPU is done with, rewinding it, or make a new one.
+	ringbuffer_poll(ring_buffer);
+	uint32_t chunk_id = 0;
+	for (; chunk_id < ring_buffer.chunks.size(); ++chunk_id) {
+	    auto &chunk = ring_buffer.chunks[chunk_id];
+	    if (chunk.last_used_value <= ring_buffer.completed_value && chunk.buffer.size >= size) {
+		chunk.offset = 0;
+		break;
+	    }
+	}
+	if (chunk_id == ring_buffer.chunks.size()) {
+	    const std::size_t chunk_size = std::max(RingBuffer::CHUNK_SIZE, round_up_p2(size));
+	    Buffer chunk_buffer = create_buffer(chunk_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, "CPU_VISIBLE_FOR_RING_BUFFER_UPLOAD");
+	    void *mapped_memory;
+	    ASSERT(vmaMapMemory(allocator, chunk_buffer.allocation, &mapped_memory), "Unable to map ring buffer chunk.");
+	    ring_buffer.chunks.push_back({chunk_buffer, (char *) mapped_memory, 0, 0});
 	}
+	ring_buffer.current_chunk = chunk_id;
     }
-    if (ring_buffer.last_id == ring_buffer.elements.size()) {
-	ASSERT(ring_buffer.elements.size() < RingBuffer::MAX_ELEMENTS, "Too many elements in ring buffer.");
-	std::size_t new_element_size = round_up_p2(size);
-	Buffer new_element_buffer = create_buffer(new_element_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, "CPU_VISIBLE_FOR_RING_BUFFER_UPLOAD");
-	VkSemaphore new_element_semaphore = create_semaphore();
 
+    auto &chunk = ring_buffer.chunks[ring_buffer.current_chunk];
+    ring_buffer.last_chunk = ring_buffer.current_chunk;
+    ring_buffer.last_offset = chunk.offset;
+    chunk.offset += (size + RingBuffer::ALIGNMENT - 1) & ~(RingBuffer::ALIGNMENT - 1);
+    // The copy out of this range goes in the next batch to be submitted.
+    chunk.last_used_value = ring_buffer.submitted_value + 1;
+    return chunk.mapped + ring_buffer.last_offset;
+}
+
+auto RenderContext::ringbuffer_command_buffer(RingBuffer &ring_buffer) noexcept -> VkCommandBuffer {
+    ZoneScoped;
+    if (ring_buffer.current_batch != RingBuffer::NO_BATCH)
+	return ring_buffer.batches[ring_buffer.current_batch].command_buffer;
+
+    ringbuffer_poll(ring_buffer);
+    uint32_t batch_id = 0;
+    for (; batch_id < ring_buffer.batches.size(); ++batch_id)
+	if (ring_buffer.batches[batch_id].signal_value <= ring_buffer.completed_value)
+	    break;
+    if (batch_id == ring_buffer.batches.size()) {
 	VkCommandBufferAllocateInfo allocate_info {};
 	allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocate_info.commandPool = command_pool;
+	allocate_info.commandPool = ring_buffer.command_pool;
 	allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 	allocate_info.commandBufferCount = 1;
 
-	VkCommandBuffer new_element_command_buffer;
-	ASSERT(vkAllocateCommandBuffers(device, &allocate_info, &new_element_command_buffer), "Unable to create command buffers.");
+	VkCommandBuffer command_buffer;
+	ASSERT(vkAllocateCommandBuffers(device, &allocate_info, &command_buffer), "Unable to create command buffers.");
+	ring_buffer.batches.push_back({command_buffer, RingBuffer::NOT_SUBMITTED});
+    }
+    ring_buffer.current_batch = batch_id;
+    auto &batch = ring_buffer.batches[batch_id];
+    batch.signal_value = RingBuffer::NOT_SUBMITTED;
 
-	ring_buffer.elements.push_back({
-		new_element_buffer,
-		new_element_size,
-		RingBuffer::NOT_OCCUPIED,
-		new_element_command_buffer,
-		new_element_semaphore
-	    });
+    VkCommandBufferBeginInfo command_buffer_begin_info {};
+    command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    ASSERT(vkBeginCommandBuffer(batch.command_buffer, &command_buffer_begin_info), "Unable to begin recording ring buffer command buffer.");
+
+    // Don't overwrite anything earlier work may still be reading.
+    vkCmdPipelineBarrier(batch.command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 0, NULL);
+    return batch.command_buffer;
+}
+
+auto RenderContext::ringbuffer_poll(RingBuffer &ring_buffer) noexcept -> uint64_t {
+    ZoneScoped;
+    ASSERT(vkGetSemaphoreCounterValue(device, ring_buffer.timeline, &ring_buffer.completed_value), "Unable to query ring buffer timeline.");
+    return ring_buffer.completed_value;
+}
+
+auto RenderContext::ringbuffer_acquire(RingBuffer &ring_buffer, VkCommandBuffer command_buffer) noexcept -> void {
+    ZoneScoped;
+    // Only batches that have already finished are acquired, so the submit
+    // waiting on acquired_value never actually stalls.
+    ring_buffer.acquired_value = ring_buffer.completed_value;
+    std::vector<VkImageMemoryBarrier> image_memory_barriers;
+    for (auto it = ring_buffer.pending_acquires.begin(); it != ring_buffer.pending_acquires.end();) {
+	if (it->first <= ring_buffer.acquired_value) {
+	    image_memory_barriers.push_back(it->second);
+	    it = ring_buffer.pending_acquires.erase(it);
+	} else {
+	    ++it;
+	}
     }
+    if (!image_memory_barriers.empty())
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0, NULL, (uint32_t) image_memory_barriers.size(), image_memory_barriers.data());
+}
 
-    ring_buffer.elements[ring_buffer.last_id].occupied = current_frame;
+auto RenderContext::ringbuffer_release_image(RingBuffer &ring_buffer, VkCommandBuffer command_buffer, VkImageMemoryBarrier image_memory_barrier, VkImageLayout dst_layout) noexcept -> void {
+    ZoneScoped;
+    image_memory_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    image_memory_barrier.newLayout = dst_layout;
+    image_memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    if (ring_buffer.queue_family == queue_family) {
+	image_memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0, NULL, 1, &image_memory_barrier);
+	return;
+    }
+
+    // Hand the image over to the graphics queue family. The layout transition
+    // in the release is repeated, identically, by the matching acquire.
+    image_memory_barrier.dstAccessMask = 0;
+    image_memory_barrier.srcQueueFamilyIndex = ring_buffer.queue_family;
+    image_memory_barrier.dstQueueFamilyIndex = queue_family;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &image_memory_barrier);
+
+    image_memory_barrier.srcAccessMask = 0;
+    image_memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    ring_buffer.pending_acquires.emplace_back(ring_buffer.submitted_value + 1, image_memory_barrier);
+}
+
+auto RenderContext::ringbuffer_flush(RingBuffer &ring_buffer) noexcept -> void {
+    ZoneScoped;
+    if (ring_buffer.current_batch == RingBuffer::NO_BATCH)
+	return;
+    auto &batch = ring_buffer.batches[ring_buffer.current_batch];
+    ASSERT(vkEndCommandBuffer(batch.command_buffer), "Something went wrong recording into ring buffer command buffer.");
+
+    // Signalling the timeline makes every copy visible to whoever waits on it.
+    batch.signal_value = ++ring_buffer.submitted_value;
+    VkTimelineSemaphoreSubmitInfo timeline_submit_info {};
+    timeline_submit_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timeline_submit_info.signalSemaphoreValueCount = 1;
+    timeline_submit_info.pSignalSemaphoreValues = &batch.signal_value;
+
+    VkSubmitInfo submit_info {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = &timeline_submit_info;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &batch.command_buffer;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &ring_buffer.timeline;
+    ASSERT(vkQueueSubmit(ring_buffer.queue, 1, &submit_info, VK_NULL_HANDLE), "Unable to submit ring buffer uploads.");
 
-    void *mapped_memory;
-    vmaMapMemory(allocator, ring_buffer.elements[ring_buffer.last_id].buffer.allocation, &mapped_memory);
-    return mapped_memory;
+    ring_buffer.current_batch = RingBuffer::NO_BATCH;
+    ring_buffer.batch_written_buffers.clear();
 }
 
-auto RenderContext::ringbuffer_submit_buffer(RingBuffer &ring_buffer, Buffer &dst, VkSemaphore *additional_semaphores, uint32_t num_semaphores) noexcept -> void {
+auto RenderContext::ringbuffer_submit_buffer(RingBuffer &ring_buffer, Buffer &dst) noexcept -> void {
     ZoneScoped;
     if (ring_buffer.last_copy_size == 0)
 	return;
-    vmaUnmapMemory(allocator, ring_buffer.elements[ring_buffer.last_id].buffer.allocation);
 
     if (ring_buffer.last_copy_size > dst.size) {
 	future_cleanup_buffer(dst);
 	dst = create_buffer(ring_buffer.last_copy_size * 2, dst.usage, dst.memory_flags, dst.vma_flags, "GENERIC_BUFFER_RECREATED_BY_RING_BUFFER_DUE_TO_SIZE");
     }
 
+    ASSERT(ring_buffer.queue_family == queue_family, "Buffer uploads must go through a ring on the graphics queue family.");
+    VkCommandBuffer command_buffer = ringbuffer_command_buffer(ring_buffer);
+
+    // Copies within a batch run unordered, so order repeated writes to a buffer.
+    if (!ring_buffer.batch_written_buffers.insert(dst.buffer).second) {
+	VkMemoryBarrier memory_barrier {};
+	memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	memory_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memory_barrier, 0, NULL, 0, NULL);
+	ring_buffer.batch_written_buffers.clear();
+	ring_buffer.batch_written_buffers.insert(dst.buffer);
+    }
+
     VkBufferCopy copy_region {};
-    copy_region.srcOffset = 0;
+    copy_region.srcOffset = ring_buffer.last_offset;
     copy_region.dstOffset = 0;
     copy_region.size = ring_buffer.last_copy_size;
-
-    VkCommandBufferBeginInfo command_buffer_begin_info {};
-    command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-    VkCommandBuffer command_buffer = ring_buffer.elements[ring_buffer.last_id].command_buffer;
-    
-    vkBeginCommandBuffer(command_buffer, &command_buffer_begin_info);
-    
-    vkCmdCopyBuffer(command_buffer, ring_buffer.elements[ring_buffer.last_id].buffer.buffer, dst.buffer, 1, &copy_region);
-    
-    vkEndCommandBuffer(command_buffer);
-    
-    VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT};
-    VkSemaphore signal_semaphore = ring_buffer.elements[ring_buffer.last_id].semaphore;
-    VkSubmitInfo submit_info {};
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &command_buffer;
-
-    auto it = ring_buffer.upload_buffer_semaphores.find(dst.buffer);
-    VkSemaphore prev_semaphore;
-    if (it != ring_buffer.upload_buffer_semaphores.end()) {
-	prev_semaphore = it->second;
-	submit_info.waitSemaphoreCount = 1;
-	submit_info.pWaitSemaphores = &prev_semaphore;
-	submit_info.pWaitDstStageMask = wait_stages;
-    } else {
-	prev_semaphore = create_semaphore();
-	ring_buffer.upload_buffer_semaphores[dst.buffer] = prev_semaphore;
-    }
-    std::vector<VkSemaphore> signal_semaphores = {prev_semaphore, signal_semaphore};
-    for (uint32_t i = 0; i < num_semaphores; ++i) {
-	signal_semaphores.push_back(additional_semaphores[i]);
-    }
-    submit_info.signalSemaphoreCount = (uint32_t) signal_semaphores.size();
-    submit_info.pSignalSemaphores = signal_semaphores.data();
-    vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE);
+    vkCmdCopyBuffer(command_buffer, ring_buffer.chunks[ring_buffer.last_chunk].buffer.buffer, dst.buffer, 1, &copy_region);
 }
 
-auto RenderContext::ringbuffer_submit_buffer(RingBuffer &ring_buffer, Image dst, VkImageLayout dst_layout, VkSemaphore *additional_semaphores, uint32_t num_semaphores) noexcept -> void {
+auto RenderContext::ringbuffer_submit_buffer(RingBuffer &ring_buffer, Image dst, VkImageLayout dst_layout) noexcept -> void {
     ZoneScoped;
-    vmaUnmapMemory(allocator, ring_buffer.elements[ring_buffer.last_id].buffer.allocation);
-
     VkImageMemoryBarrier image_memory_barrier {};
     image_memory_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
     image_memory_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -414,70 +499,36 @@ auto RenderContext::ringbuffer_submit_buffer(RingBuffer &ring_buffer, Image dst,
     image_memory_barrier.image = dst.image;
     image_memory_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     image_memory_barrier.subresourceRange.baseMipLevel = 0;
-    image_memory_barrier.subresourceRange.levelCount = 1;
+    image_memory_barrier.subresourceRange.levelCount = dst.mip_levels;
     image_memory_barrier.subresourceRange.baseArrayLayer = 0;
     image_memory_barrier.subresourceRange.layerCount = 1;
     image_memory_barrier.srcAccessMask = 0;
     image_memory_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
 
-    VkBufferImageCopy copy_region {};
-    copy_region.bufferOffset = 0;
-    copy_region.bufferRowLength = 0;
-    copy_region.bufferImageHeight = 0;
-    copy_region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    copy_region.imageSubresource.layerCount = 1;
-    copy_region.imageOffset = {0, 0, 0};
-    copy_region.imageExtent = {dst.extent.width, dst.extent.height, 1};
-
-    VkCommandBufferBeginInfo command_buffer_begin_info {};
-    command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-    VkCommandBuffer command_buffer = ring_buffer.elements[ring_buffer.last_id].command_buffer;
-    
-    vkBeginCommandBuffer(command_buffer, &command_buffer_begin_info);
+    // Mip levels are packed tightly one after another in the staging buffer.
+    std::vector<VkBufferImageCopy> copy_regions(dst.mip_levels);
+    VkDeviceSize buffer_offset = ring_buffer.last_offset;
+    for (uint32_t level = 0; level < dst.mip_levels; ++level) {
+	copy_regions[level].bufferOffset = buffer_offset;
+	copy_regions[level].bufferRowLength = 0;
+	copy_regions[level].bufferImageHeight = 0;
+	copy_regions[level].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	copy_regions[level].imageSubresource.mipLevel = level;
+	copy_regions[level].imageSubresource.baseArrayLayer = 0;
+	copy_regions[level].imageSubresource.layerCount = 1;
+	copy_regions[level].imageOffset = {0, 0, 0};
+	copy_regions[level].imageExtent = {std::max(dst.extent.width >> level, 1U), std::max(dst.extent.height >> level, 1U), 1};
+	buffer_offset += texture_level_size(dst.format, dst.extent, level);
+    }
 
+    VkCommandBuffer command_buffer = ringbuffer_command_buffer(ring_buffer);
     vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &image_memory_barrier);
-    vkCmdCopyBufferToImage(command_buffer, ring_buffer.elements[ring_buffer.last_id].buffer.buffer, dst.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
-
-    image_memory_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    image_memory_barrier.newLayout = dst_layout;
-    image_memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    image_memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &image_memory_barrier);
-    
-    vkEndCommandBuffer(command_buffer);
-    
-    VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT};
-    VkSemaphore signal_semaphore = ring_buffer.elements[ring_buffer.last_id].semaphore;
-    VkSubmitInfo submit_info {};
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &command_buffer;
-
-    auto it = ring_buffer.upload_image_semaphores.find(dst.image);
-    VkSemaphore prev_semaphore;
-    if (it != ring_buffer.upload_image_semaphores.end()) {
-	prev_semaphore = it->second;
-	submit_info.waitSemaphoreCount = 1;
-	submit_info.pWaitSemaphores = &prev_semaphore;
-	submit_info.pWaitDstStageMask = wait_stages;
-    } else {
-	prev_semaphore = create_semaphore();
-	ring_buffer.upload_image_semaphores[dst.image] = prev_semaphore;
-    }
-    std::vector<VkSemaphore> signal_semaphores = {prev_semaphore, signal_semaphore};
-    for (uint32_t i = 0; i < num_semaphores; ++i) {
-	signal_semaphores.push_back(additional_semaphores[i]);
-    }
-    submit_info.signalSemaphoreCount = (uint32_t) signal_semaphores.size();
-    submit_info.pSignalSemaphores = signal_semaphores.data();
-    vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE);
+    vkCmdCopyBufferToImage(command_buffer, ring_buffer.chunks[ring_buffer.last_chunk].buffer.buffer, dst.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t) copy_regions.size(), copy_regions.data());
+    ringbuffer_release_image(ring_buffer, command_buffer, image_memory_barrier, dst_layout);
 }
 
-auto RenderContext::ringbuffer_submit_buffer(RingBuffer &ring_buffer, Volume dst, VkImageLayout dst_layout, VkSemaphore *additional_semaphores, uint32_t num_semaphores) noexcept -> void {
+auto RenderContext::ringbuffer_submit_buffer(RingBuffer &ring_buffer, Volume dst, std::size_t texel_size, VkImageLayout dst_layout) noexcept -> void {
     ZoneScoped;
-    vmaUnmapMemory(allocator, ring_buffer.elements[ring_buffer.last_id].buffer.allocation);
-
     VkImageMemoryBarrier image_memory_barrier {};
     image_memory_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
     image_memory_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -487,64 +538,40 @@ auto RenderContext::ringbuffer_submit_buffer(RingBuffer &ring_buffer, Volume dst
     image_memory_barrier.image = dst.image;
     image_memory_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     image_memory_barrier.subresourceRange.baseMipLevel = 0;
-    image_memory_barrier.subresourceRange.levelCount = 1;
+    image_memory_barrier.subresourceRange.levelCount = dst.mip_levels;
     image_memory_barrier.subresourceRange.baseArrayLayer = 0;
     image_memory_barrier.subresourceRange.layerCount = 1;
     image_memory_barrier.srcAccessMask = 0;
     image_memory_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
 
-    VkBufferImageCopy copy_region {};
-    copy_region.bufferOffset = 0;
-    copy_region.bufferRowLength = 0;
-    copy_region.bufferImageHeight = 0;
-    copy_region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    copy_region.imageSubresource.layerCount = 1;
-    copy_region.imageOffset = {0, 0, 0};
-    copy_region.imageExtent = dst.extent;
-
-    VkCommandBufferBeginInfo command_buffer_begin_info {};
-    command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-    VkCommandBuffer command_buffer = ring_buffer.elements[ring_buffer.last_id].command_buffer;
-    
-    vkBeginCommandBuffer(command_buffer, &command_buffer_begin_info);
-
-    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &image_memory_barrier);
-    vkCmdCopyBufferToImage(command_buffer, ring_buffer.elements[ring_buffer.last_id].buffer.buffer, dst.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
-
-    image_memory_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    image_memory_barrier.newLayout = dst_layout;
-    image_memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    image_memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &image_memory_barrier);
-    
-    vkEndCommandBuffer(command_buffer);
-    
-    VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT};
-    VkSemaphore signal_semaphore = ring_buffer.elements[ring_buffer.last_id].semaphore;
-    VkSubmitInfo submit_info {};
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &command_buffer;
-
-    auto it = ring_buffer.upload_image_semaphores.find(dst.image);
-    VkSemaphore prev_semaphore;
-    if (it != ring_buffer.upload_image_semaphores.end()) {
-	prev_semaphore = it->second;
-	submit_info.waitSemaphoreCount = 1;
-	submit_info.pWaitSemaphores = &prev_semaphore;
-	submit_info.pWaitDstStageMask = wait_stages;
-    } else {
-	prev_semaphore = create_semaphore();
-	ring_buffer.upload_image_semaphores[dst.image] = prev_semaphore;
+    // Mip levels are packed tightly one after another in the staging buffer.
+    std::vector<VkExtent3D> mip_extents(dst.mip_levels);
+    std::size_t total_texels = 0;
+    for (uint32_t level = 0; level < dst.mip_levels; ++level) {
+	mip_extents[level] = {std::max(dst.extent.width >> level, 1U), std::max(dst.extent.height >> level, 1U), std::max(dst.extent.depth >> level, 1U)};
+	total_texels += (std::size_t) mip_extents[level].width * mip_extents[level].height * mip_extents[level].depth;
     }
-    std::vector<VkSemaphore> signal_semaphores = {prev_semaphore, signal_semaphore};
-    for (uint32_t i = 0; i < num_semaphores; ++i) {
-	signal_semaphores.push_back(additional_semaphores[i]);
+    ASSERT(ring_buffer.last_copy_size == total_texels * texel_size, "Staged volume data doesn't match the volume's mip chain.");
+
+    std::vector<VkBufferImageCopy> copy_regions(dst.mip_levels);
+    VkDeviceSize buffer_offset = ring_buffer.last_offset;
+    for (uint32_t level = 0; level < dst.mip_levels; ++level) {
+	copy_regions[level].bufferOffset = buffer_offset;
+	copy_regions[level].bufferRowLength = 0;
+	copy_regions[level].bufferImageHeight = 0;
+	copy_regions[level].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	copy_regions[level].imageSubresource.mipLevel = level;
+	copy_regions[level].imageSubresource.baseArrayLayer = 0;
+	copy_regions[level].imageSubresource.layerCount = 1;
+	copy_regions[level].imageOffset = {0, 0, 0};
+	copy_regions[level].imageExtent = mip_extents[level];
+	buffer_offset += (VkDeviceSize) mip_extents[level].width * mip_extents[level].height * mip_extents[level].depth * texel_size;
     }
-    submit_info.signalSemaphoreCount = (uint32_t) signal_semaphores.size();
-    submit_info.pSignalSemaphores = signal_semaphores.data();
-    vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE);
+
+    VkCommandBuffer command_buffer = ringbuffer_command_buffer(ring_buffer);
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &image_memory_barrier);
+    vkCmdCopyBufferToImage(command_buffer, ring_buffer.chunks[ring_buffer.last_chunk].buffer.buffer, dst.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t) copy_regions.size(), copy_regions.data());
+    ringbuffer_release_image(ring_buffer, command_buffer, image_memory_barrier, dst_layout);
 }
 
 auto RenderContext::get_device_address(const Buffer &buffer) noexcept -> VkDeviceAddress {
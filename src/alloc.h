@@ -15,7 +15,7 @@
 #ifndef ALLOC_H
 #define ALLOC_H
 
-#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <vulkan/vulkan.h>
@@ -36,51 +36,59 @@ struct Image {
     VkImage image;
     VmaAllocation allocation;
     VkExtent2D extent;
+    VkFormat format;
+    uint32_t mip_levels;
 };
 
 struct Volume {
     VkImage image;
     VmaAllocation allocation;
     VkExtent3D extent;
+    uint32_t mip_levels;
 };
 
+// Staging memory for uploads: a few persistently mapped chunks, each used as
+// a bump allocator. Copies out of them are recorded into one transfer command
+// buffer per frame, submitted just before whatever first needs the data. Each
+// submitted batch signals the next value of a timeline semaphore, so consumers
+// wait on one value and a chunk is rewound once the value it was staged under
+// has been reached. A ring on another queue family than the graphics queue
+// releases the images it uploads, and the render command buffer acquires them
+// once their batch has finished.
 struct RingBuffer {
-    struct RingElement {
+    struct Chunk {
 	Buffer buffer;
-	std::size_t size;
-	std::size_t occupied;
-	VkCommandBuffer command_buffer;
-	VkSemaphore semaphore;
+	char *mapped;
+	std::size_t offset;
+	uint64_t last_used_value;
     };
 
-    static const std::size_t NOT_OCCUPIED = 0xFFFFFFFFFFFFFFFF;
-    static const std::size_t MAX_ELEMENTS = 0xFFFF;
-
-    std::unordered_map<VkBuffer, VkSemaphore> upload_buffer_semaphores;
-    std::unordered_map<VkImage, VkSemaphore> upload_image_semaphores;
-    std::vector<RingElement> elements;
-    std::size_t last_copy_size;
-    uint16_t last_id;
-
-    auto get_number_occupied(std::size_t current_frame) const noexcept -> uint16_t {
-	uint16_t num = 0;
-	for (auto &element : elements)
-	    if (element.occupied == current_frame)
-		++num;
-	return num;
-    }
+    struct Batch {
+	VkCommandBuffer command_buffer;
+	uint64_t signal_value;
+    };
 
-    auto get_new_semaphores(VkSemaphore *dst, std::size_t current_frame) const noexcept -> void {
-	for (auto &element : elements)
-	    if (element.occupied == current_frame)
-		*(dst++) = element.semaphore;
-    }
+    static constexpr std::size_t CHUNK_SIZE = 1 << 26;
+    static constexpr std::size_t ALIGNMENT = 16;
+    static constexpr uint64_t NOT_SUBMITTED = 0xFFFFFFFFFFFFFFFF;
+    static constexpr uint32_t NO_BATCH = 0xFFFFFFFF;
 
-    auto clear_occupied(std::size_t clear_frame) noexcept -> void {
-	for (auto &element : elements)
-	    if (element.occupied == clear_frame)
-		element.occupied = RingBuffer::NOT_OCCUPIED;
-    }
+    std::vector<Chunk> chunks;
+    std::vector<Batch> batches;
+    std::unordered_set<VkBuffer> batch_written_buffers;
+    std::vector<std::pair<uint64_t, VkImageMemoryBarrier>> pending_acquires;
+    VkQueue queue;
+    VkCommandPool command_pool;
+    uint32_t queue_family;
+    VkSemaphore timeline;
+    uint64_t submitted_value = 0;
+    uint64_t completed_value = 0;
+    uint64_t acquired_value = 0;
+    std::size_t last_copy_size = 0;
+    std::size_t last_offset = 0;
+    uint32_t last_chunk = 0;
+    uint32_t current_chunk = 0;
+    uint32_t current_batch = NO_BATCH;
 };
 
 #endif
@@ -18,18 +18,20 @@
 
 auto RenderContext::create_command_pool() noexcept -> void {
     ZoneScoped;
-    const uint32_t queue_family = physical_check_queue_family(physical_device, (VkQueueFlagBits) (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT));
-
     VkCommandPoolCreateInfo create_info {};
     create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
     create_info.queueFamilyIndex = queue_family;
 
     ASSERT(vkCreateCommandPool(device, &create_info, NULL, &command_pool), "Unable to create command pool.");
+
+    create_info.queueFamilyIndex = transfer_queue_family;
+    ASSERT(vkCreateCommandPool(device, &create_info, NULL, &transfer_command_pool), "Unable to create transfer command pool.");
 }
 
 auto RenderContext::cleanup_command_pool() noexcept -> void {
     ZoneScoped;
+    vkDestroyCommandPool(device, transfer_command_pool, NULL);
     vkDestroyCommandPool(device, command_pool, NULL);
 }
 
@@ -39,40 +41,35 @@ auto RenderContext::create_command_buffers() noexcept -> void {
     allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocate_info.commandPool = command_pool;
     allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocate_info.commandBufferCount = 1;
+    allocate_info.commandBufferCount = FRAMES_IN_FLIGHT;
 
-    ASSERT(vkAllocateCommandBuffers(device, &allocate_info, &render_command_buffer), "Unable to create command buffers.");
+    ASSERT(vkAllocateCommandBuffers(device, &allocate_info, render_command_buffers.data()), "Unable to create command buffers.");
+
+    allocate_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    ASSERT(vkAllocateCommandBuffers(device, &allocate_info, imgui_command_buffers.data()), "Unable to create command buffers.");
 }
 
-auto RenderContext::record_render_command_buffer(VkCommandBuffer command_buffer, uint32_t image_index) noexcept -> void {
+auto RenderContext::begin_secondary_command_buffer(VkCommandBuffer command_buffer, VkRenderPass render_pass, VkFramebuffer framebuffer, VkCommandBufferUsageFlags usage_flags) noexcept -> void {
     ZoneScoped;
+    VkCommandBufferInheritanceInfo inheritance_info {};
+    inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritance_info.renderPass = render_pass;
+    inheritance_info.subpass = 0;
+    inheritance_info.framebuffer = framebuffer;
+
     VkCommandBufferBeginInfo begin_info {};
     begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = usage_flags | (render_pass != VK_NULL_HANDLE ? VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT : 0);
+    begin_info.pInheritanceInfo = &inheritance_info;
 
-    ASSERT(vkBeginCommandBuffer(command_buffer, &begin_info), "Unable to begin recording command buffer.");
-
-    VkClearValue clear_values[2];
-    clear_values[0].color.float32[0] = 0.0f / 100.0f;
-    clear_values[0].color.float32[1] = 0.0f / 100.0f;
-    clear_values[0].color.float32[2] = 0.0f / 100.0f;
-    clear_values[0].color.float32[3] = 1.0f;
-    clear_values[1].depthStencil.depth = 1.0f;
-    clear_values[1].depthStencil.stencil = 0;
-
-    VkViewport viewport {};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float) swapchain_extent.width;
-    viewport.height = (float) swapchain_extent.width;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
+    ASSERT(vkBeginCommandBuffer(command_buffer, &begin_info), "Unable to begin recording secondary command buffer.");
+}
 
-    VkRect2D scissor = {};
-    scissor.offset.x = 0;
-    scissor.offset.y = 0;
-    scissor.extent = swapchain_extent;
+auto RenderContext::record_trace_passes(VkCommandBuffer command_buffer) noexcept -> void {
+    ZoneScoped;
+    begin_secondary_command_buffer(command_buffer, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT);
 
-    push_constants.filter_iter = 0;
+    PushConstants push_constants {};
     vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, ray_trace_pipeline);
     vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, ray_trace_pipeline_layout, 0, 1, &raster_descriptor_set, 0, NULL);
     vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, ray_trace_pipeline_layout, 1, 1, &ray_trace_descriptor_set, 0, NULL);
@@ -110,6 +107,119 @@ auto RenderContext::record_render_command_buffer(VkCommandBuffer command_buffer,
 	++push_constants.filter_iter;
     }
 
+    ASSERT(vkEndCommandBuffer(command_buffer), "Something went wrong recording into a trace command buffer.");
+}
+
+auto RenderContext::record_raster_pass(VkCommandBuffer command_buffer) noexcept -> void {
+    ZoneScoped;
+    // The framebuffer is left out so the same recording works for every
+    // swapchain image.
+    begin_secondary_command_buffer(command_buffer, raster_render_pass, VK_NULL_HANDLE, VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT);
+
+    VkViewport viewport {};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = (float) swapchain_extent.width;
+    viewport.height = (float) swapchain_extent.width;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+
+    VkRect2D scissor = {};
+    scissor.offset.x = 0;
+    scissor.offset.y = 0;
+    scissor.extent = swapchain_extent;
+
+    // TAA reads whichever image the last filter pass wrote.
+    PushConstants push_constants {};
+    push_constants.filter_iter = (imgui_data.temporal_filter ? 1 : 0) + (uint32_t) imgui_data.atrous_filter_iters;
+
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, raster_pipeline);
+    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, raster_pipeline_layout, 0, 1, &raster_descriptor_set, 0, NULL);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, raster_pipeline_layout, 1, 1, &ray_trace_descriptor_set, 0, NULL);
+    vkCmdPushConstants(command_buffer, raster_pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstants), &push_constants);
+    vkCmdDraw(command_buffer, 6, 1, 0, 0);
+
+    ASSERT(vkEndCommandBuffer(command_buffer), "Something went wrong recording into a raster command buffer.");
+}
+
+auto RenderContext::find_or_record_cached_passes() noexcept -> const CachedPasses & {
+    ZoneScoped;
+    const uint32_t key = ((uint32_t) imgui_data.atrous_filter_iters << 1) | (imgui_data.temporal_filter ? 1 : 0);
+    auto it = cached_passes.find(key);
+    if (it != cached_passes.end())
+	return it->second;
+
+    // A configuration is recorded once and kept, since an older recording may
+    // still be pending in a frame in flight. Every frame slot's primary
+    // executes the same recording, so it's marked for simultaneous use.
+    VkCommandBuffer command_buffers[2];
+    VkCommandBufferAllocateInfo allocate_info {};
+    allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocate_info.commandPool = command_pool;
+    allocate_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    allocate_info.commandBufferCount = 2;
+    ASSERT(vkAllocateCommandBuffers(device, &allocate_info, command_buffers), "Unable to create command buffers.");
+
+    CachedPasses passes {command_buffers[0], command_buffers[1]};
+    record_trace_passes(passes.trace);
+    record_raster_pass(passes.raster);
+    return cached_passes[key] = passes;
+}
+
+auto RenderContext::cleanup_cached_passes() noexcept -> void {
+    ZoneScoped;
+    for (auto &[_, passes] : cached_passes) {
+	VkCommandBuffer command_buffers[] = {passes.trace, passes.raster};
+	vkFreeCommandBuffers(device, command_pool, 2, command_buffers);
+    }
+    cached_passes.clear();
+}
+
+auto RenderContext::record_render_command_buffer(VkCommandBuffer command_buffer, uint32_t image_index) noexcept -> void {
+    ZoneScoped;
+    VkCommandBufferBeginInfo begin_info {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+    ASSERT(vkBeginCommandBuffer(command_buffer, &begin_info), "Unable to begin recording command buffer.");
+
+    // The previous frame may still be running on the queue. Its shader passes
+    // read and write the images this frame's passes use, including the TAA
+    // history that this frame's fragment stage reads. Its ray tracing reads
+    // the TLAS this frame refits, and its own refit wrote that TLAS and the
+    // shared TLAS scratch buffer. Uploads and presentation are already
+    // ordered by the ring's semaphores and the render pass.
+    VkMemoryBarrier memory_barrier {};
+    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			 VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			 0, 1, &memory_barrier, 0, NULL, 0, NULL);
+
+    VkClearValue clear_values[2];
+    clear_values[0].color.float32[0] = 0.0f / 100.0f;
+    clear_values[0].color.float32[1] = 0.0f / 100.0f;
+    clear_values[0].color.float32[2] = 0.0f / 100.0f;
+    clear_values[0].color.float32[3] = 1.0f;
+    clear_values[1].depthStencil.depth = 1.0f;
+    clear_values[1].depthStencil.stencil = 0;
+
+    // Take ownership of streamed textures whose uploads have finished.
+    ringbuffer_acquire(streaming_ring_buffer, command_buffer);
+
+    record_top_level_refit(command_buffer);
+
+    // Only the ImGui draws are recorded from scratch each frame.
+    const CachedPasses &passes = find_or_record_cached_passes();
+    vkCmdExecuteCommands(command_buffer, 1, &passes.trace);
+
+    VkCommandBuffer imgui_command_buffer = imgui_command_buffers[current_frame % FRAMES_IN_FLIGHT];
+    begin_secondary_command_buffer(imgui_command_buffer, raster_render_pass, swapchain_framebuffers[image_index], 0);
+    render_draw_data_wrapper_imgui(imgui_command_buffer);
+    ASSERT(vkEndCommandBuffer(imgui_command_buffer), "Something went wrong recording into an ImGui command buffer.");
+
     VkRenderPassBeginInfo render_pass_begin_info {};
     render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     render_pass_begin_info.renderPass = raster_render_pass;
@@ -120,17 +230,9 @@ auto RenderContext::record_render_command_buffer(VkCommandBuffer command_buffer,
     render_pass_begin_info.pClearValues = clear_values;
     render_pass_begin_info.clearValueCount = 1;
 
-    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, raster_pipeline);
-    vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
-    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
-    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
-
-    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, raster_pipeline_layout, 0, 1, &raster_descriptor_set, 0, NULL);
-    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, raster_pipeline_layout, 1, 1, &ray_trace_descriptor_set, 0, NULL);
-    vkCmdPushConstants(command_buffer, raster_pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstants), &push_constants);
-    vkCmdDraw(command_buffer, 6, 1, 0, 0);
-    render_draw_data_wrapper_imgui(command_buffer);
-
+    const VkCommandBuffer raster_command_buffers[] = {passes.raster, imgui_command_buffer};
+    vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    vkCmdExecuteCommands(command_buffer, 2, raster_command_buffers);
     vkCmdEndRenderPass(command_buffer);
 
     ASSERT(vkEndCommandBuffer(command_buffer), "Something went wrong recording into a raster command buffer.");
@@ -138,16 +240,20 @@ auto RenderContext::record_render_command_buffer(VkCommandBuffer command_buffer,
 
 auto RenderContext::create_sync_objects() noexcept -> void {
     ZoneScoped;
-    image_available_semaphore = create_semaphore();
-    render_finished_semaphore = create_semaphore();
-    in_flight_fence = create_fence();
+    for (uint32_t frame = 0; frame < FRAMES_IN_FLIGHT; ++frame) {
+	image_available_semaphores[frame] = create_semaphore();
+	render_finished_semaphores[frame] = create_semaphore();
+	in_flight_fences[frame] = create_fence();
+    }
 }
 
 auto RenderContext::cleanup_sync_objects() noexcept -> void {
     ZoneScoped;
-    vkDestroySemaphore(device, image_available_semaphore, NULL);
-    vkDestroySemaphore(device, render_finished_semaphore, NULL);
-    vkDestroyFence(device, in_flight_fence, NULL);
+    for (uint32_t frame = 0; frame < FRAMES_IN_FLIGHT; ++frame) {
+	vkDestroySemaphore(device, image_available_semaphores[frame], NULL);
+	vkDestroySemaphore(device, render_finished_semaphores[frame], NULL);
+	vkDestroyFence(device, in_flight_fences[frame], NULL);
+    }
 }
 
 auto RenderContext::create_semaphore() noexcept -> VkSemaphore {
@@ -160,6 +266,22 @@ auto RenderContext::create_semaphore() noexcept -> VkSemaphore {
     return result;
 }
 
+auto RenderContext::create_timeline_semaphore(uint64_t initial_value) noexcept -> VkSemaphore {
+    ZoneScoped;
+    VkSemaphoreTypeCreateInfo semaphore_type_info {};
+    semaphore_type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    semaphore_type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    semaphore_type_info.initialValue = initial_value;
+
+    VkSemaphoreCreateInfo semaphore_info {};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphore_info.pNext = &semaphore_type_info;
+
+    VkSemaphore result;
+    ASSERT(vkCreateSemaphore(device, &semaphore_info, NULL, &result), "Unable to create timeline semaphore.");
+    return result;
+}
+
 auto RenderContext::create_fence() noexcept -> VkFence {
     ZoneScoped;
     VkFenceCreateInfo fence_info {};
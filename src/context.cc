@@ -61,12 +61,14 @@ auto RenderContext::init() noexcept -> void {
     create_command_buffers();
     create_sync_objects();
     create_one_off_objects();
+    create_asset_loader();
     init_imgui();
 }
 
 auto RenderContext::create_one_off_objects() noexcept -> void {
     ZoneScoped;
-    main_ring_buffer = create_ringbuffer();
+    main_ring_buffer = create_ringbuffer(queue, command_pool, queue_family);
+    streaming_ring_buffer = create_ringbuffer(transfer_queue, transfer_command_pool, transfer_queue_family);
 
     projection_buffer = create_buffer(PROJECTION_BUFFER_SIZE, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "PROJECTION_BUFFER");
     cube_buffer = create_buffer(sizeof(VkAabbPositionsKHR), VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "CUBE_BUFFER");
@@ -108,7 +110,15 @@ auto RenderContext::render() noexcept -> void {
 
     render_imgui();
 
+    // Only wait for the frame that last used this slot, so the CPU can record
+    // up to FRAMES_IN_FLIGHT frames ahead of the GPU.
+    const uint32_t frame_slot = current_frame % FRAMES_IN_FLIGHT;
+    VkFence in_flight_fence = in_flight_fences[frame_slot];
+    VkCommandBuffer render_command_buffer = render_command_buffers[frame_slot];
+    VkSemaphore image_available_semaphore = image_available_semaphores[frame_slot];
+    VkSemaphore render_finished_semaphore = render_finished_semaphores[frame_slot];
     vkWaitForFences(device, 1, &in_flight_fence, VK_TRUE, UINT64_MAX);
+    update_streamed_texture_descriptors(frame_slot);
 
     uint32_t image_index;
     const VkResult acquire_next_image_result = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, image_available_semaphore, VK_NULL_HANDLE, &image_index);
@@ -122,20 +132,31 @@ auto RenderContext::render() noexcept -> void {
     vkResetCommandBuffer(render_command_buffer, 0);
     record_render_command_buffer(render_command_buffer, image_index);
 
-    const uint16_t num_wait_semaphores = 1 + main_ring_buffer.get_number_occupied(current_frame);
-    ring_buffer_semaphore_scratchpad.reserve(num_wait_semaphores);
-    ring_buffer_semaphore_scratchpad.resize(num_wait_semaphores);
-    ring_buffer_wait_stages_scratchpad.reserve(num_wait_semaphores);
-    ring_buffer_wait_stages_scratchpad.resize(num_wait_semaphores, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
-    main_ring_buffer.get_new_semaphores(ring_buffer_semaphore_scratchpad.data(), current_frame);
-    ring_buffer_semaphore_scratchpad[num_wait_semaphores - 1] = image_available_semaphore;
-    main_ring_buffer.clear_occupied(current_frame - 1);
+    // Everything staged this frame goes to the GPU in one submission ahead of
+    // the frame that reads it.
+    ringbuffer_flush(main_ring_buffer);
+
+    // Values for the binary semaphores are ignored. The main timeline wait
+    // covers every upload staged so far. The streaming wait only covers
+    // batches already seen finished, so it orders the acquires without
+    // ever holding the frame back on an upload.
+    const VkSemaphore wait_semaphores[] = {image_available_semaphore, main_ring_buffer.timeline, streaming_ring_buffer.timeline};
+    const VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT};
+    const uint64_t wait_values[] = {0, main_ring_buffer.submitted_value, streaming_ring_buffer.acquired_value};
+    const uint64_t signal_value = 0;
+    VkTimelineSemaphoreSubmitInfo timeline_submit_info {};
+    timeline_submit_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timeline_submit_info.waitSemaphoreValueCount = 3;
+    timeline_submit_info.pWaitSemaphoreValues = wait_values;
+    timeline_submit_info.signalSemaphoreValueCount = 1;
+    timeline_submit_info.pSignalSemaphoreValues = &signal_value;
 
     VkSubmitInfo submit_info{};
     submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.waitSemaphoreCount = num_wait_semaphores;
-    submit_info.pWaitSemaphores = ring_buffer_semaphore_scratchpad.data();
-    submit_info.pWaitDstStageMask = ring_buffer_wait_stages_scratchpad.data();;
+    submit_info.pNext = &timeline_submit_info;
+    submit_info.waitSemaphoreCount = 3;
+    submit_info.pWaitSemaphores = wait_semaphores;
+    submit_info.pWaitDstStageMask = wait_stages;
     submit_info.commandBufferCount = 1;
     submit_info.pCommandBuffers = &render_command_buffer;
     submit_info.signalSemaphoreCount = 1;
@@ -159,7 +180,7 @@ auto RenderContext::render() noexcept -> void {
     }
 
     for (auto it = buffer_cleanup_queue.begin(); it != buffer_cleanup_queue.end();) {
-	if (it->second + 1 == current_frame) {
+	if (it->second + FRAMES_IN_FLIGHT <= current_frame) {
 	    cleanup_buffer(it->first);
 	    it = buffer_cleanup_queue.erase(it);
 	} else {
@@ -176,8 +197,10 @@ auto RenderContext::cleanup() noexcept -> void {
     for (auto [buffer, _] : buffer_cleanup_queue) {
 	cleanup_buffer(buffer);
     }
+    cleanup_asset_loader();
     cleanup_imgui();
     cleanup_one_off_objects();
+    cleanup_cached_passes();
     cleanup_sync_objects();
     cleanup_framebuffers();
     cleanup_descriptor_pool();
@@ -203,6 +226,7 @@ auto RenderContext::cleanup() noexcept -> void {
 auto RenderContext::cleanup_one_off_objects() noexcept -> void {
     ZoneScoped;
     cleanup_ringbuffer(main_ring_buffer);
+    cleanup_ringbuffer(streaming_ring_buffer);
     cleanup_buffer(projection_buffer);
     cleanup_buffer(cube_buffer);
     cleanup_image_view(blue_noise_image_view);
@@ -21,15 +21,21 @@
 #include <array>
 #include <tuple>
 #include <map>
+#include <span>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include "loader.h"
 #include "scene.h"
 #include "util.h"
 
 #define TRACY_CALLSTACK 20
 
+#ifndef FRAMES_IN_FLIGHT
+#define FRAMES_IN_FLIGHT 2
+#endif
+
 #define VKFN_MEMBER(fn)				\
     PFN_ ## fn fn
 
@@ -53,22 +59,43 @@ struct ImGuiData {
     float sigma_position = 0.01f;
     float sigma_luminance = 2.0f;
     int atrous_filter_iters = 5;
+    std::size_t blas_bytes_before_compaction = 0;
+    std::size_t blas_bytes_after_compaction = 0;
 };
 
 struct RenderContext {
-    struct PushConstants {
+    // Settings that change from frame to frame live in the projection uniform
+    // rather than push constants, so recorded passes can be replayed as-is.
+    struct FrameConstants {
 	uint32_t current_frame;
 	float alpha_temporal;
 	float alpha_taa;
 	float sigma_normal;
 	float sigma_position;
 	float sigma_luminance;
-	uint32_t filter_iter;
 	uint32_t num_filter_iters;
 	uint32_t temporal;
 	uint32_t taa;
     };
+
+    struct PushConstants {
+	uint32_t filter_iter;
+    };
     static_assert(sizeof(PushConstants) <= 128, "Push constants must fit in 128 bytes.");
+
+    // Secondary command buffers for the passes whose commands only depend on
+    // the filter configuration and the swapchain extent.
+    struct CachedPasses {
+	VkCommandBuffer trace;
+	VkCommandBuffer raster;
+    };
+
+    struct BottomLevelBuild {
+	VkAccelerationStructureGeometryKHR geometry;
+	VkAccelerationStructureBuildRangeInfoKHR range;
+	VkAccelerationStructureKHR *dst;
+	Buffer *dst_buffer;
+    };
     
     GLFWwindow *window;
     bool active = true, resized = false;
@@ -86,6 +113,9 @@ struct RenderContext {
     VkPhysicalDevice physical_device;
     VkDevice device;
     VkQueue queue;
+    uint32_t queue_family;
+    VkQueue transfer_queue;
+    uint32_t transfer_queue_family;
 
     VkSwapchainKHR swapchain;
     VkFormat swapchain_format;
@@ -118,6 +148,8 @@ struct RenderContext {
     VkStridedDeviceAddressRegionKHR call_sbt_region;
 
     static constexpr uint32_t PROJECTION_BUFFER_SIZE = 1024;
+    static constexpr uint32_t FRAME_CONSTANTS_OFFSET = 832;
+    static_assert(FRAME_CONSTANTS_OFFSET + sizeof(FrameConstants) <= PROJECTION_BUFFER_SIZE, "Frame constants must fit in the projection buffer.");
     Buffer projection_buffer;
     Buffer cube_buffer;
     Image blue_noise_image;
@@ -126,16 +158,19 @@ struct RenderContext {
     VkImageView motion_vector_image_view;
     std::array<Image, 2> taa_images;
     std::array<VkImageView, 2> taa_image_views;
-    PushConstants push_constants;
+    FrameConstants frame_constants;
     RingBuffer main_ring_buffer;
+    RingBuffer streaming_ring_buffer;
+    AssetLoader asset_loader;
 
     VkCommandPool command_pool;
-    VkCommandBuffer render_command_buffer;
-    VkSemaphore image_available_semaphore;
-    VkSemaphore render_finished_semaphore;
-    VkFence in_flight_fence;
-    std::vector<VkSemaphore> ring_buffer_semaphore_scratchpad;
-    std::vector<VkPipelineStageFlags> ring_buffer_wait_stages_scratchpad;
+    VkCommandPool transfer_command_pool;
+    std::array<VkCommandBuffer, FRAMES_IN_FLIGHT> render_command_buffers;
+    std::array<VkCommandBuffer, FRAMES_IN_FLIGHT> imgui_command_buffers;
+    std::map<uint32_t, CachedPasses> cached_passes;
+    std::array<VkSemaphore, FRAMES_IN_FLIGHT> image_available_semaphores;
+    std::array<VkSemaphore, FRAMES_IN_FLIGHT> render_finished_semaphores;
+    std::array<VkFence, FRAMES_IN_FLIGHT> in_flight_fences;
 
     VkSampler sampler;
     VkDescriptorPool descriptor_pool, imgui_descriptor_pool;
@@ -190,7 +225,8 @@ struct RenderContext {
     auto create_command_buffers() noexcept -> void;
     auto create_sync_objects() noexcept -> void;
     auto create_one_off_objects() noexcept -> void;
-    auto create_ringbuffer() noexcept -> RingBuffer;
+    auto create_ringbuffer(VkQueue ring_queue, VkCommandPool ring_command_pool, uint32_t ring_queue_family) noexcept -> RingBuffer;
+    auto create_asset_loader() noexcept -> void;
 
     auto cleanup_instance() noexcept -> void;
     auto cleanup_surface() noexcept -> void;
@@ -212,8 +248,10 @@ struct RenderContext {
     auto cleanup_sync_objects() noexcept -> void;
     auto cleanup_one_off_objects() noexcept -> void;
     auto cleanup_ringbuffer(RingBuffer &ring_buffer) noexcept -> void;
+    auto cleanup_asset_loader() noexcept -> void;
 
     auto physical_check_queue_family(VkPhysicalDevice physical_device, VkQueueFlagBits bits) noexcept -> uint32_t;
+    auto physical_check_transfer_queue_family(VkPhysicalDevice physical_device) noexcept -> uint32_t;
     auto physical_check_extensions(VkPhysicalDevice physical_device) noexcept -> int32_t;
     auto physical_check_swapchain_support(VkPhysicalDevice physical_device) noexcept -> SwapchainSupport;
     auto physical_check_features_support(VkPhysicalDevice physical_device) noexcept -> int32_t;
@@ -235,8 +273,14 @@ struct RenderContext {
     auto cleanup_image3d_view(VkImageView view) noexcept -> void;
 
     auto record_render_command_buffer(VkCommandBuffer command_buffer, uint32_t image_index) noexcept -> void;
+    auto begin_secondary_command_buffer(VkCommandBuffer command_buffer, VkRenderPass render_pass, VkFramebuffer framebuffer, VkCommandBufferUsageFlags usage_flags) noexcept -> void;
+    auto record_trace_passes(VkCommandBuffer command_buffer) noexcept -> void;
+    auto record_raster_pass(VkCommandBuffer command_buffer) noexcept -> void;
+    auto find_or_record_cached_passes() noexcept -> const CachedPasses &;
+    auto cleanup_cached_passes() noexcept -> void;
 
     auto create_semaphore() noexcept -> VkSemaphore;
+    auto create_timeline_semaphore(uint64_t initial_value) noexcept -> VkSemaphore;
     auto create_fence() noexcept -> VkFence;
 
     auto recreate_swapchain() noexcept -> void;
@@ -244,6 +288,7 @@ struct RenderContext {
     auto allocate_vulkan_objects_for_scene(Scene &scene) noexcept -> void;
     auto cleanup_vulkan_objects_for_scene(Scene &scene) noexcept -> void;
     auto update_vulkan_objects_for_scene(Scene &scene) noexcept -> void;
+    auto share_mesh_offsets(Scene &scene) noexcept -> void;
     auto ringbuffer_copy_scene_vertices_into_buffer(Scene &scene) noexcept -> void;
     auto ringbuffer_copy_scene_indices_into_buffer(Scene &scene) noexcept -> void;
     auto ringbuffer_copy_scene_instances_into_buffer(Scene &scene) noexcept -> void;
@@ -252,28 +297,45 @@ struct RenderContext {
     auto ringbuffer_copy_scene_ray_trace_objects_into_buffer(Scene &scene) noexcept -> void;
     auto ringbuffer_copy_scene_voxel_palettes_into_buffer(Scene &scene) noexcept -> void;
     auto ringbuffer_copy_scene_light_aabbs_into_buffer(Scene &scene) noexcept -> void;
+    auto ringbuffer_copy_scene_svos_into_buffer(Scene &scene) noexcept -> void;
     auto ringbuffer_copy_projection_matrices_into_buffer() noexcept -> void;
 
     auto ringbuffer_claim_buffer(RingBuffer &ring_buffer, std::size_t size) noexcept -> void *;
-    auto ringbuffer_submit_buffer(RingBuffer &ring_buffer, Buffer &dst, VkSemaphore *additional_semaphores = NULL, uint32_t num_semaphores = 0) noexcept -> void;
-    auto ringbuffer_submit_buffer(RingBuffer &ring_buffer, Image dst, VkImageLayout dst_layout, VkSemaphore *additional_semaphores = NULL, uint32_t num_semaphores = 0) noexcept -> void;
-    auto ringbuffer_submit_buffer(RingBuffer &ring_buffer, Volume dst, VkImageLayout dst_layout, VkSemaphore *additional_semaphores = NULL, uint32_t num_semaphores = 0) noexcept -> void;
+    auto ringbuffer_command_buffer(RingBuffer &ring_buffer) noexcept -> VkCommandBuffer;
+    auto ringbuffer_poll(RingBuffer &ring_buffer) noexcept -> uint64_t;
+    auto ringbuffer_acquire(RingBuffer &ring_buffer, VkCommandBuffer command_buffer) noexcept -> void;
+    auto ringbuffer_release_image(RingBuffer &ring_buffer, VkCommandBuffer command_buffer, VkImageMemoryBarrier image_memory_barrier, VkImageLayout dst_layout) noexcept -> void;
+    auto ringbuffer_flush(RingBuffer &ring_buffer) noexcept -> void;
+    auto ringbuffer_submit_buffer(RingBuffer &ring_buffer, Buffer &dst) noexcept -> void;
+    auto ringbuffer_submit_buffer(RingBuffer &ring_buffer, Image dst, VkImageLayout dst_layout) noexcept -> void;
+    auto ringbuffer_submit_buffer(RingBuffer &ring_buffer, Volume dst, std::size_t texel_size, VkImageLayout dst_layout) noexcept -> void;
 
     auto load_model(std::string_view model_name, Scene &scene, const uint8_t *custom_mat = NULL) noexcept -> uint16_t;
     auto load_obj_model(std::string_view obj_filepath) noexcept -> Model;
-    auto load_texture(std::string_view texture_filepath, bool srgb) noexcept -> std::pair<Image, VkImageView>;
+    auto load_texture_async(std::string_view texture_filepath, bool srgb, uint16_t texture_id) noexcept -> std::pair<Image, VkImageView>;
+    auto load_material_texture_async(std::string_view obj_filepath, uint16_t texture_id) noexcept -> std::pair<Image, VkImageView>;
+    auto upload_texture(RingBuffer &ring_buffer, const uint8_t *data, VkFormat format, VkExtent2D extent, uint32_t mip_levels) noexcept -> std::pair<Image, VkImageView>;
+    auto upload_decoded_textures(Scene &scene) noexcept -> void;
+    auto update_streamed_texture_descriptors(uint32_t frame_slot) noexcept -> void;
     auto load_image(std::string_view texture_filepath) noexcept -> std::pair<Image, VkImageView>;
     auto load_custom_model(const std::vector<Model::Vertex> &vertices, const std::vector<uint32_t> &indices, uint8_t red_albedo, uint8_t green_albedo, uint8_t blue_albedo, uint8_t roughness, uint8_t metallicity, Scene &scene) noexcept -> uint16_t;
-    auto load_custom_material(uint8_t red_albedo, uint8_t green_albedo, uint8_t blue_albedo, uint8_t roughness, uint8_t metallicity, uint8_t mask = 0xF) noexcept -> std::array<std::pair<Image, VkImageView>, 4>;
+    auto load_solid_texture(std::array<uint8_t, 4> rgba, bool srgb) noexcept -> std::pair<Image, VkImageView>;
+    auto find_or_load_texture(Scene &scene, const std::string &key, const std::function<std::pair<Image, VkImageView>(uint16_t)> &load) noexcept -> uint16_t;
+    auto find_or_load_solid_texture(Scene &scene, std::array<uint8_t, 4> rgba, bool srgb) noexcept -> uint16_t;
+    auto load_custom_material(uint8_t red_albedo, uint8_t green_albedo, uint8_t blue_albedo, uint8_t roughness, uint8_t metallicity, uint8_t mask = 0x7) noexcept -> std::array<std::pair<Image, VkImageView>, 3>;
     auto load_voxel_model(std::string_view model_name, Scene &scene) noexcept -> uint16_t;
     auto load_dot_vox_model(std::string_view vox_filepath) noexcept -> VoxelModel;
     auto upload_voxel_model(const VoxelModel &voxel_model) noexcept -> std::pair<Volume, VkImageView>;
     auto load_volumetric_model(std::string_view model_name, Scene &scene) noexcept -> uint16_t;
     auto load_dot_bin_model(std::string_view bin_filepath) noexcept -> VoxelModel;
+    auto load_svo_model(std::string_view model_name, Scene &scene) noexcept -> uint16_t;
+    auto load_dot_svo_model(std::string_view svo_filepath) noexcept -> std::vector<uint32_t>;
 
     auto update_descriptors_textures(const Scene &scene, uint32_t update_texture) noexcept -> void;
+    auto update_descriptors_texture_for_frame_slot(VkImageView view, uint32_t update_texture, uint32_t frame_slot) noexcept -> void;
     auto update_descriptors_volumes(const Scene &scene, uint32_t update_volume) noexcept -> void;
     auto update_descriptors_palettes(const Scene &scene) noexcept -> void;
+    auto update_descriptors_svos(const Scene &scene) noexcept -> void;
     auto update_descriptors_lights(const Scene &scene) noexcept -> void;
     auto update_descriptors_perspective() noexcept -> void;
     auto update_descriptors_tlas(const Scene &scene) noexcept -> void;
@@ -285,10 +347,21 @@ struct RenderContext {
 
     auto get_device_address(const Buffer &buffer) noexcept -> VkDeviceAddress;
     auto get_device_address(const VkAccelerationStructureKHR &acceleration_structure) noexcept -> VkDeviceAddress;
-    auto build_bottom_level_acceleration_structure_for_model(uint16_t model_idx, Scene &scene) noexcept -> void;
-    auto build_bottom_level_acceleration_structure_for_voxel_model(uint16_t voxel_model_idx, Scene &scene, bool solid = true) noexcept -> void;
-    auto build_bottom_level_acceleration_structure_for_lights(Scene &scene) noexcept -> void;
+    auto bottom_level_build_for_model(uint16_t model_idx, Scene &scene) noexcept -> BottomLevelBuild;
+    auto bottom_level_build_for_voxel_model(uint16_t voxel_model_idx, Scene &scene) noexcept -> BottomLevelBuild;
+    auto bottom_level_build_for_lights(Scene &scene) noexcept -> BottomLevelBuild;
+    auto build_bottom_level_acceleration_structures(std::span<const uint16_t> model_idxs, std::span<const uint16_t> voxel_model_idxs, Scene &scene) noexcept -> void;
+    auto build_bottom_level_acceleration_structures(std::span<BottomLevelBuild> builds) noexcept -> void;
+    auto count_top_level_instances(const Scene &scene) noexcept -> uint32_t;
+    auto write_top_level_instances(const Scene &scene, VkAccelerationStructureInstanceKHR *dst) noexcept -> void;
+    auto top_level_build_geometry(const Scene &scene, uint32_t instances_slot) noexcept -> VkAccelerationStructureGeometryKHR;
     auto build_top_level_acceleration_structure_for_scene(Scene &scene) noexcept -> void;
+    auto cleanup_top_level_acceleration_structure_for_scene(Scene &scene) noexcept -> void;
+    auto update_top_level_acceleration_structure_for_scene(Scene &scene) noexcept -> void;
+    auto record_top_level_refit(VkCommandBuffer command_buffer) noexcept -> void;
+
+    Scene *tlas_refit_scene = NULL;
+    std::vector<VkAccelerationStructureInstanceKHR> tlas_instances_scratchpad;
 
     auto init_imgui() noexcept -> void;
     auto cleanup_imgui() noexcept -> void;
@@ -334,12 +407,24 @@ struct RenderContext {
 	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 	
+	// One-off commands may read anything uploaded so far.
+	ringbuffer_flush(main_ring_buffer);
 	ASSERT(vkBeginCommandBuffer(inefficient_one_time_command_buffer, &begin_info), "Unable to begin recording one-time command buffer.");
 	F(inefficient_one_time_command_buffer);
 	ASSERT(vkEndCommandBuffer(inefficient_one_time_command_buffer), "Something went wrong recording into one-time rcommand buffer.");
 
+	VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+	VkTimelineSemaphoreSubmitInfo timeline_submit_info {};
+	timeline_submit_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timeline_submit_info.waitSemaphoreValueCount = 1;
+	timeline_submit_info.pWaitSemaphoreValues = &main_ring_buffer.submitted_value;
+
 	VkSubmitInfo submit_info {};
 	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.pNext = &timeline_submit_info;
+	submit_info.waitSemaphoreCount = 1;
+	submit_info.pWaitSemaphores = &main_ring_buffer.timeline;
+	submit_info.pWaitDstStageMask = &wait_stage;
 	submit_info.commandBufferCount = 1;
 	submit_info.pCommandBuffers = &inefficient_one_time_command_buffer;
 
@@ -355,6 +440,8 @@ struct RenderContext {
     VKFN_MEMBER(vkGetRayTracingShaderGroupHandlesKHR);
     VKFN_MEMBER(vkDestroyAccelerationStructureKHR);
     VKFN_MEMBER(vkCmdTraceRaysKHR);
+    VKFN_MEMBER(vkCmdWriteAccelerationStructuresPropertiesKHR);
+    VKFN_MEMBER(vkCmdCopyAccelerationStructureKHR);
     
     auto init_vk_funcs() noexcept -> void {
 	VKFN_INIT(vkGetAccelerationStructureBuildSizesKHR);
@@ -365,6 +452,8 @@ struct RenderContext {
 	VKFN_INIT(vkGetRayTracingShaderGroupHandlesKHR);
 	VKFN_INIT(vkDestroyAccelerationStructureKHR);
 	VKFN_INIT(vkCmdTraceRaysKHR);
+	VKFN_INIT(vkCmdWriteAccelerationStructuresPropertiesKHR);
+	VKFN_INIT(vkCmdCopyAccelerationStructureKHR);
     }
 };
 
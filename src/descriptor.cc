@@ -17,6 +17,9 @@
 #include "context.h"
 
 static constexpr uint32_t MAX_MODELS = 256;
+// Every texture gets one descriptor per frame in flight, interleaved, so a
+// streamed texture can be rebound for one frame slot while the others run.
+static constexpr uint32_t MAX_TEXTURE_DESCRIPTORS = MAX_MODELS * FRAMES_IN_FLIGHT;
 
 auto RenderContext::create_sampler() noexcept -> void {
     ZoneScoped;
@@ -35,10 +38,10 @@ auto RenderContext::create_sampler() noexcept -> void {
     sampler_create_info.unnormalizedCoordinates = VK_FALSE;
     sampler_create_info.compareEnable = VK_FALSE;
     sampler_create_info.compareOp = VK_COMPARE_OP_ALWAYS;
-    sampler_create_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    sampler_create_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
     sampler_create_info.mipLodBias = 0.0f;
     sampler_create_info.minLod = 0.0f;
-    sampler_create_info.maxLod = 0.0f;
+    sampler_create_info.maxLod = VK_LOD_CLAMP_NONE;
 
     ASSERT(vkCreateSampler(device, &sampler_create_info, NULL, &sampler), "Unable to create sampler.");
 }
@@ -52,7 +55,7 @@ auto RenderContext::create_descriptor_pool() noexcept -> void {
     ZoneScoped;
     VkDescriptorPoolSize descriptor_pool_sizes[] = {
 	{ VK_DESCRIPTOR_TYPE_SAMPLER, 1000 },
-	{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1000 },
+	{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1000 + MAX_TEXTURE_DESCRIPTORS },
 	{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1000 },
 	{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1000 },
 	{ VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER, 1000 },
@@ -122,14 +125,16 @@ auto RenderContext::create_descriptor_set_layout() noexcept -> void {
     
     VkDescriptorSetLayoutBinding bindless_textures_layout_binding {};
     bindless_textures_layout_binding.binding = 2;
-    bindless_textures_layout_binding.descriptorCount = MAX_MODELS;
+    bindless_textures_layout_binding.descriptorCount = MAX_TEXTURE_DESCRIPTORS;
     bindless_textures_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     bindless_textures_layout_binding.pImmutableSamplers = NULL;
     bindless_textures_layout_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR | VK_SHADER_STAGE_INTERSECTION_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT;
     
     VkDescriptorSetLayoutBinding bindings[] = {lights_buffer_layout_binding, perspective_buffer_layout_binding, bindless_textures_layout_binding};
     
-    VkDescriptorBindingFlags bindless_flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT;
+    // A frame slot's texture descriptors are rewritten while the other slots'
+    // frames are pending, which only read their own descriptors.
+    VkDescriptorBindingFlags bindless_flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
     VkDescriptorBindingFlags bindings_flags[] = {0, 0, bindless_flags};
 
     VkDescriptorSetLayoutBindingFlagsCreateInfo layout_binding_flags_create_info {};
@@ -232,10 +237,17 @@ auto RenderContext::create_ray_trace_descriptor_set_layout() noexcept -> void {
     voxel_palettes_layout_binding.pImmutableSamplers = NULL;
     voxel_palettes_layout_binding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR | VK_SHADER_STAGE_INTERSECTION_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT;
     
+    VkDescriptorSetLayoutBinding svos_layout_binding {};
+    svos_layout_binding.binding = 38;
+    svos_layout_binding.descriptorCount = 1;
+    svos_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    svos_layout_binding.pImmutableSamplers = NULL;
+    svos_layout_binding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_INTERSECTION_BIT_KHR;
+    
     VkDescriptorSetLayoutBinding bindless_volumes_layout_binding {};
-    bindless_volumes_layout_binding.binding = 38;
+    bindless_volumes_layout_binding.binding = 39;
     bindless_volumes_layout_binding.descriptorCount = MAX_MODELS;
-    bindless_volumes_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    bindless_volumes_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     bindless_volumes_layout_binding.pImmutableSamplers = NULL;
     bindless_volumes_layout_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR | VK_SHADER_STAGE_INTERSECTION_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT;
     
@@ -278,12 +290,13 @@ auto RenderContext::create_ray_trace_descriptor_set_layout() noexcept -> void {
 	taa_texture_layout_bindings[0],
 	taa_texture_layout_bindings[1],
 	voxel_palettes_layout_binding,
+	svos_layout_binding,
 	bindless_volumes_layout_binding,
     };
 
     VkDescriptorBindingFlags bindless_flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT;
-    VkDescriptorBindingFlags bindings_flags[39] = {0};
-    bindings_flags[38] = bindless_flags;
+    VkDescriptorBindingFlags bindings_flags[40] = {0};
+    bindings_flags[39] = bindless_flags;
 
     VkDescriptorSetLayoutBindingFlagsCreateInfo layout_binding_flags_create_info {};
     layout_binding_flags_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
@@ -307,7 +320,7 @@ auto RenderContext::cleanup_ray_trace_descriptor_set_layout() noexcept -> void {
 
 auto RenderContext::create_descriptor_sets() noexcept -> void {
     ZoneScoped;
-    uint32_t max_variable_count = MAX_MODELS;
+    uint32_t max_variable_count = MAX_TEXTURE_DESCRIPTORS;
     
     VkDescriptorSetVariableDescriptorCountAllocateInfo variable_count_allocate_info {};
     variable_count_allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO;
@@ -344,17 +357,23 @@ auto RenderContext::create_ray_trace_descriptor_sets() noexcept -> void {
 }
 
 auto RenderContext::update_descriptors_textures(const Scene &scene, uint32_t update_texture) noexcept -> void {
+    ZoneScoped;
+    for (uint32_t frame_slot = 0; frame_slot < FRAMES_IN_FLIGHT; ++frame_slot)
+	update_descriptors_texture_for_frame_slot(scene.textures[update_texture].second, update_texture, frame_slot);
+}
+
+auto RenderContext::update_descriptors_texture_for_frame_slot(VkImageView view, uint32_t update_texture, uint32_t frame_slot) noexcept -> void {
     ZoneScoped;
     VkDescriptorImageInfo descriptor_image_info {};
     descriptor_image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    descriptor_image_info.imageView = scene.textures[update_texture].second;
+    descriptor_image_info.imageView = view;
     descriptor_image_info.sampler = sampler;
     
     VkWriteDescriptorSet write_descriptor_set {};
     write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
     write_descriptor_set.dstSet = raster_descriptor_set;
     write_descriptor_set.dstBinding = 2;
-    write_descriptor_set.dstArrayElement = update_texture;
+    write_descriptor_set.dstArrayElement = update_texture * FRAMES_IN_FLIGHT + frame_slot;
     write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     write_descriptor_set.descriptorCount = 1;
     write_descriptor_set.pImageInfo = &descriptor_image_info;
@@ -370,13 +389,14 @@ auto RenderContext::update_descriptors_volumes(const Scene &scene, uint32_t upda
     VkDescriptorImageInfo descriptor_image_info {};
     descriptor_image_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
     descriptor_image_info.imageView = scene.voxel_volumes[update_volume].second;
+    descriptor_image_info.sampler = sampler;
     
     VkWriteDescriptorSet write_descriptor_set {};
     write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
     write_descriptor_set.dstSet = ray_trace_descriptor_set;
-    write_descriptor_set.dstBinding = 38;
+    write_descriptor_set.dstBinding = 39;
     write_descriptor_set.dstArrayElement = update_volume;
-    write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     write_descriptor_set.descriptorCount = 1;
     write_descriptor_set.pImageInfo = &descriptor_image_info;
     write_descriptor_set.pBufferInfo = NULL;
@@ -408,6 +428,28 @@ auto RenderContext::update_descriptors_palettes(const Scene &scene) noexcept ->
     vkUpdateDescriptorSets(device, 1, &write_descriptor_set, 0, NULL);
 }
 
+auto RenderContext::update_descriptors_svos(const Scene &scene) noexcept -> void {
+    ZoneScoped;
+    VkDescriptorBufferInfo descriptor_buffer_info {};
+    descriptor_buffer_info.buffer = scene.svo_buf.buffer;
+    descriptor_buffer_info.offset = 0;
+    descriptor_buffer_info.range = VK_WHOLE_SIZE;
+    
+    VkWriteDescriptorSet write_descriptor_set {};
+    write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_descriptor_set.dstSet = ray_trace_descriptor_set;
+    write_descriptor_set.dstBinding = 38;
+    write_descriptor_set.dstArrayElement = 0;
+    write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write_descriptor_set.descriptorCount = 1;
+    write_descriptor_set.pImageInfo = NULL;
+    write_descriptor_set.pBufferInfo = &descriptor_buffer_info;
+    write_descriptor_set.pTexelBufferView = NULL;
+    write_descriptor_set.pNext = NULL;
+
+    vkUpdateDescriptorSets(device, 1, &write_descriptor_set, 0, NULL);
+}
+
 auto RenderContext::update_descriptors_lights(const Scene &scene) noexcept -> void {
     ZoneScoped;
     VkDescriptorBufferInfo descriptor_buffer_info {};
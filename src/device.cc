@@ -88,6 +88,29 @@ auto RenderContext::physical_check_queue_family(VkPhysicalDevice physical, VkQue
     return 0xFFFFFFFF;
 }
 
+auto RenderContext::physical_check_transfer_queue_family(VkPhysicalDevice physical) noexcept -> uint32_t {
+    ZoneScoped;
+    uint32_t queue_family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical, &queue_family_count, NULL);
+    ASSERT(queue_family_count > 0, "No queue families.");
+
+    std::vector<VkQueueFamilyProperties> possible(queue_family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(physical, &queue_family_count, &possible[0]);
+
+    // Only take a transfer-only family if it can copy arbitrary mip levels.
+    for (uint32_t queue_family_index = 0; queue_family_index < queue_family_count; ++queue_family_index) {
+	const VkQueueFamilyProperties &properties = possible[queue_family_index];
+	const VkExtent3D &granularity = properties.minImageTransferGranularity;
+	if ((properties.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+	    !(properties.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+	    granularity.width == 1 && granularity.height == 1 && granularity.depth == 1) {
+	    return queue_family_index;
+	}
+    }
+
+    return 0xFFFFFFFF;
+}
+
 auto RenderContext::physical_check_extensions(VkPhysicalDevice physical) noexcept -> int32_t {
     ZoneScoped;
     uint32_t extension_count = 0;
@@ -144,9 +167,13 @@ auto RenderContext::physical_check_features_support(VkPhysicalDevice physical) n
     ray_tracing_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR;
     ray_tracing_features.pNext = &acceleration_features;
 
+    VkPhysicalDeviceTimelineSemaphoreFeatures timeline_semaphore_features {};
+    timeline_semaphore_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+    timeline_semaphore_features.pNext = &ray_tracing_features;
+
     VkPhysicalDeviceVulkan11Features vulkan_11_features {};
     vulkan_11_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
-    vulkan_11_features.pNext = &ray_tracing_features;
+    vulkan_11_features.pNext = &timeline_semaphore_features;
 
     VkPhysicalDeviceDescriptorIndexingFeatures indexing_features {};
     indexing_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
@@ -161,11 +188,15 @@ auto RenderContext::physical_check_features_support(VkPhysicalDevice physical) n
     
     if (indexing_features.descriptorBindingPartiallyBound &&
 	indexing_features.runtimeDescriptorArray &&
+	indexing_features.descriptorBindingSampledImageUpdateAfterBind &&
+	indexing_features.descriptorBindingUpdateUnusedWhilePending &&
 	vulkan_11_features.shaderDrawParameters &&
+	timeline_semaphore_features.timelineSemaphore &&
 	ray_tracing_features.rayTracingPipeline &&
 	acceleration_features.accelerationStructure &&
 	acceleration_features.descriptorBindingAccelerationStructureUpdateAfterBind &&
-	buffer_device_address_features.bufferDeviceAddress
+	buffer_device_address_features.bufferDeviceAddress &&
+	device_features.features.textureCompressionBC
 	) {
 	return 0;
     }
@@ -255,16 +286,39 @@ auto RenderContext::create_physical_device() noexcept -> void {
 
 auto RenderContext::create_device() noexcept -> void {
     ZoneScoped;
-    const uint32_t queue_family = physical_check_queue_family(physical_device, (VkQueueFlagBits) (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT));
+    queue_family = physical_check_queue_family(physical_device, (VkQueueFlagBits) (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT));
     ASSERT(queue_family, "Could not find queue family.");
 
-    const float queue_priority = 1.0f;
-
-    VkDeviceQueueCreateInfo queue_create_info {};
-    queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queue_create_info.queueFamilyIndex = queue_family;
-    queue_create_info.queueCount = 1;
-    queue_create_info.pQueuePriorities = &queue_priority;
+    uint32_t queue_family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, NULL);
+    std::vector<VkQueueFamilyProperties> queue_family_properties(queue_family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, &queue_family_properties[0]);
+
+    // Streaming uploads go on a dedicated transfer family if there is one,
+    // else on a second queue of the graphics family, else on the main queue.
+    const float queue_priorities[] = {1.0f, 0.5f};
+    uint32_t transfer_queue_index = 0;
+    transfer_queue_family = physical_check_transfer_queue_family(physical_device);
+
+    VkDeviceQueueCreateInfo queue_create_infos[2] {};
+    uint32_t num_queue_create_infos = 1;
+    queue_create_infos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queue_create_infos[0].queueFamilyIndex = queue_family;
+    queue_create_infos[0].queueCount = 1;
+    queue_create_infos[0].pQueuePriorities = queue_priorities;
+    if (transfer_queue_family != 0xFFFFFFFF) {
+	queue_create_infos[1].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	queue_create_infos[1].queueFamilyIndex = transfer_queue_family;
+	queue_create_infos[1].queueCount = 1;
+	queue_create_infos[1].pQueuePriorities = &queue_priorities[1];
+	num_queue_create_infos = 2;
+    } else {
+	transfer_queue_family = queue_family;
+	if (queue_family_properties[queue_family].queueCount > 1) {
+	    queue_create_infos[0].queueCount = 2;
+	    transfer_queue_index = 1;
+	}
+    }
 
     VkPhysicalDeviceBufferDeviceAddressFeatures buffer_device_address_features {};
     buffer_device_address_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES;
@@ -282,15 +336,22 @@ auto RenderContext::create_device() noexcept -> void {
     ray_tracing_features.rayTracingPipeline = VK_TRUE;
     ray_tracing_features.pNext = &acceleration_features;
 
+    VkPhysicalDeviceTimelineSemaphoreFeatures timeline_semaphore_features {};
+    timeline_semaphore_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+    timeline_semaphore_features.timelineSemaphore = VK_TRUE;
+    timeline_semaphore_features.pNext = &ray_tracing_features;
+
     VkPhysicalDeviceVulkan11Features vulkan_11_features {};
     vulkan_11_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
     vulkan_11_features.shaderDrawParameters = VK_TRUE;
-    vulkan_11_features.pNext = &ray_tracing_features;
+    vulkan_11_features.pNext = &timeline_semaphore_features;
 
     VkPhysicalDeviceDescriptorIndexingFeatures indexing_features {};
     indexing_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
     indexing_features.descriptorBindingPartiallyBound = VK_TRUE;
     indexing_features.runtimeDescriptorArray = VK_TRUE;
+    indexing_features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    indexing_features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
     indexing_features.pNext = &vulkan_11_features;
 
     VkPhysicalDeviceFeatures2 device_features {};
@@ -302,14 +363,21 @@ auto RenderContext::create_device() noexcept -> void {
 
     VkDeviceCreateInfo device_create_info {};
     device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    device_create_info.queueCreateInfoCount = 1;
-    device_create_info.pQueueCreateInfos = &queue_create_info;
+    device_create_info.queueCreateInfoCount = num_queue_create_infos;
+    device_create_info.pQueueCreateInfos = queue_create_infos;
     device_create_info.pNext = &device_features;
     device_create_info.enabledExtensionCount = sizeof(device_extensions) / sizeof(device_extensions[0]);
     device_create_info.ppEnabledExtensionNames = device_extensions;
 
     ASSERT(vkCreateDevice(physical_device, &device_create_info, NULL, &device), "Couldn't create logical device.");
     vkGetDeviceQueue(device, queue_family, 0, &queue);
+    vkGetDeviceQueue(device, transfer_queue_family, transfer_queue_index, &transfer_queue);
+    if (transfer_queue_family != queue_family)
+	std::cout << "INFO: Streaming uploads on dedicated transfer queue family " << transfer_queue_family << ".\n";
+    else if (transfer_queue != queue)
+	std::cout << "INFO: Streaming uploads on a second graphics queue.\n";
+    else
+	std::cout << "INFO: Streaming uploads share the graphics queue.\n";
     init_vk_funcs();
 }
 
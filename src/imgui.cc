@@ -34,7 +34,7 @@ auto RenderContext::init_imgui() noexcept -> void {
     vulkan_init_info.Queue = queue;
     vulkan_init_info.DescriptorPool = imgui_descriptor_pool;
     vulkan_init_info.MinImageCount = 3;
-    vulkan_init_info.ImageCount = 3;
+    vulkan_init_info.ImageCount = std::max(3U, (uint32_t) FRAMES_IN_FLIGHT);
     vulkan_init_info.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
     
     ImGui_ImplVulkan_Init(&vulkan_init_info, raster_render_pass);
@@ -115,6 +115,9 @@ auto RenderContext::render_imgui() noexcept -> void {
     std::ostringstream pos_label;
     pos_label << "POSITION: " << camera_position.x << " " << camera_position.y << " " << camera_position.z;
     ImGui::Text(pos_label.str().c_str());
+    std::ostringstream blas_label;
+    blas_label << "BLAS MEMORY: " << imgui_data.blas_bytes_after_compaction << " bytes (" << imgui_data.blas_bytes_before_compaction << " before compaction)";
+    ImGui::TextUnformatted(blas_label.str().c_str());
     ImGui::SliderFloat("Alpha (Temporal)", &imgui_data.alpha_temporal, 0.0f, 1.0f);
     ImGui::SliderFloat("Alpha (TAA)", &imgui_data.alpha_taa, 0.0f, 1.0f);
     ImGui::SliderFloat("Sigma - Normal", &imgui_data.sigma_normal, 0.001f, 5.0f);
@@ -0,0 +1,171 @@
+/*
+ * This file is part of trace.
+ * trace is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ * trace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with trace. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Tracy.hpp"
+
+#include "context.h"
+#include "texture.h"
+
+auto RenderContext::create_asset_loader() noexcept -> void {
+    ZoneScoped;
+    asset_loader.placeholder_textures = load_custom_material(128, 128, 128, 255, 0);
+    const uint32_t num_workers = std::max(std::thread::hardware_concurrency(), 2U) - 1;
+    for (uint32_t i = 0; i < num_workers; ++i)
+	asset_loader.workers.emplace_back([this]() { asset_loader.work(); });
+}
+
+auto RenderContext::cleanup_asset_loader() noexcept -> void {
+    ZoneScoped;
+    {
+	std::lock_guard lock(asset_loader.mutex);
+	asset_loader.stopping = true;
+    }
+    asset_loader.jobs_available.notify_all();
+    for (auto &worker : asset_loader.workers)
+	worker.join();
+    asset_loader.workers.clear();
+    asset_loader.jobs.clear();
+    asset_loader.decoded_textures.clear();
+    for (auto &upload : asset_loader.in_flight_uploads) {
+	cleanup_image_view(upload.texture.second);
+	cleanup_image(upload.texture.first);
+    }
+    asset_loader.in_flight_uploads.clear();
+    asset_loader.pending_swaps.clear();
+    for (auto &placeholder : asset_loader.placeholder_textures) {
+	cleanup_image_view(placeholder.second);
+	cleanup_image(placeholder.first);
+    }
+}
+
+auto RenderContext::load_texture_async(std::string_view texture_filepath, bool srgb, uint16_t texture_id) noexcept -> std::pair<Image, VkImageView> {
+    ZoneScoped;
+    ++asset_loader.num_pending;
+    asset_loader.enqueue([this, filepath = std::string(texture_filepath), srgb, texture_id]() {
+	ZoneScopedN("decode_texture");
+	AssetLoader::DecodedTexture decoded {};
+	decoded.texture_id = texture_id;
+
+	// Prefer a block compressed bake of the texture, if there's a fresh one.
+	// Otherwise decode the PNG and filter its mips here, off the render thread.
+	BakedTexture baked;
+	if (!read_baked_texture(filepath, baked)) {
+	    int tex_width, tex_height, tex_channels;
+	    stbi_uc* pixels = stbi_load(filepath.c_str(), &tex_width, &tex_height, &tex_channels, STBI_rgb_alpha);
+	    ASSERT(pixels, "Unable to load texture.");
+	    const bool normal_map = bake_format_for_texture(filepath) == VK_FORMAT_BC5_UNORM_BLOCK;
+	    generate_texture_mips(pixels, {(uint32_t) tex_width, (uint32_t) tex_height}, srgb, normal_map, baked);
+	    stbi_image_free(pixels);
+	}
+	decoded.format = baked.format;
+	decoded.extent = baked.extent;
+	decoded.mip_levels = baked.mip_levels;
+	decoded.data = std::move(baked.data);
+
+	std::lock_guard lock(asset_loader.mutex);
+	asset_loader.decoded_textures.push_back(std::move(decoded));
+    });
+    // Color textures are the only sRGB ones, everything else is a normal map.
+    return asset_loader.placeholder_textures[srgb ? 0 : 1];
+}
+
+auto RenderContext::load_material_texture_async(std::string_view obj_filepath, uint16_t texture_id) noexcept -> std::pair<Image, VkImageView> {
+    ZoneScoped;
+    ++asset_loader.num_pending;
+    asset_loader.enqueue([this, paths = material_texture_paths(obj_filepath), texture_id]() {
+	ZoneScopedN("decode_material_texture");
+	AssetLoader::DecodedTexture decoded {};
+	decoded.texture_id = texture_id;
+
+	BakedTexture baked;
+	if (!read_baked_material_texture(paths, baked)) {
+	    std::cout << "WARNING: Material texture bake " << paths.baked << " is missing or stale, decoding the source textures. Run make textures.\n";
+	    std::vector<uint8_t> rgba;
+	    VkExtent2D extent;
+	    ASSERT(decode_material_texture(paths, rgba, extent), "Unable to load material texture.");
+	    generate_texture_mips(rgba.data(), extent, false, false, baked);
+	}
+	decoded.format = baked.format;
+	decoded.extent = baked.extent;
+	decoded.mip_levels = baked.mip_levels;
+	decoded.data = std::move(baked.data);
+
+	std::lock_guard lock(asset_loader.mutex);
+	asset_loader.decoded_textures.push_back(std::move(decoded));
+    });
+    return asset_loader.placeholder_textures[2];
+}
+
+auto RenderContext::upload_decoded_textures(Scene &scene) noexcept -> void {
+    ZoneScoped;
+    asset_loader.upload_scratchpad.clear();
+    {
+	std::lock_guard lock(asset_loader.mutex);
+	std::size_t upload_size = 0;
+	while (!asset_loader.decoded_textures.empty() && upload_size < AssetLoader::UPLOAD_BUDGET_PER_FRAME) {
+	    upload_size += asset_loader.decoded_textures.back().data.size();
+	    asset_loader.upload_scratchpad.push_back(std::move(asset_loader.decoded_textures.back()));
+	    asset_loader.decoded_textures.pop_back();
+	}
+    }
+
+    // Copies run on the streaming ring's queue. The placeholders stay bound
+    // until a later frame sees the copies finished, so rendering never waits.
+    for (const auto &decoded : asset_loader.upload_scratchpad) {
+	auto texture = upload_texture(streaming_ring_buffer, decoded.data.data(), decoded.format, decoded.extent, decoded.mip_levels);
+	asset_loader.in_flight_uploads.push_back({decoded.texture_id, texture, streaming_ring_buffer.submitted_value + 1});
+    }
+    asset_loader.upload_scratchpad.clear();
+    ringbuffer_flush(streaming_ring_buffer);
+
+    if (asset_loader.in_flight_uploads.empty())
+	return;
+    const uint64_t completed_value = ringbuffer_poll(streaming_ring_buffer);
+    for (auto it = asset_loader.in_flight_uploads.begin(); it != asset_loader.in_flight_uploads.end();) {
+	if (it->upload_value > completed_value) {
+	    ++it;
+	    continue;
+	}
+
+	// The scene owns the texture from here on. Its descriptors are only
+	// switched over by update_streamed_texture_descriptors.
+	ASSERT(asset_loader.is_placeholder(scene.textures[it->texture_id].second), "Streamed texture replaced something other than a placeholder.");
+	scene.textures[it->texture_id] = it->texture;
+	asset_loader.pending_swaps.push_back({it->texture_id, it->texture.second, 0});
+	it = asset_loader.in_flight_uploads.erase(it);
+    }
+}
+
+auto RenderContext::update_streamed_texture_descriptors(uint32_t frame_slot) noexcept -> void {
+    ZoneScoped;
+    // Frames only sample the descriptor copies of their own frame slot, and
+    // this slot's last frame has retired. Every frame from now on is recorded
+    // after the texture's upload finished, so it also acquires the texture.
+    bool swapped = false;
+    for (auto it = asset_loader.pending_swaps.begin(); it != asset_loader.pending_swaps.end();) {
+	if (!(it->written_frame_slots & (1u << frame_slot))) {
+	    update_descriptors_texture_for_frame_slot(it->view, it->texture_id, frame_slot);
+	    it->written_frame_slots |= 1u << frame_slot;
+	}
+	if (it->written_frame_slots != (1u << FRAMES_IN_FLIGHT) - 1) {
+	    ++it;
+	    continue;
+	}
+	--asset_loader.num_pending;
+	swapped = true;
+	it = asset_loader.pending_swaps.erase(it);
+    }
+    if (swapped && !asset_loader.num_pending)
+	std::cout << "INFO: Finished streaming textures.\n";
+}
@@ -0,0 +1,98 @@
+/*
+ * This file is part of trace.
+ * trace is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ * trace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with trace. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <condition_variable>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <array>
+
+#include "alloc.h"
+
+struct AssetLoader {
+    struct DecodedTexture {
+	uint16_t texture_id;
+	VkFormat format;
+	VkExtent2D extent;
+	uint32_t mip_levels;
+	std::vector<uint8_t> data;
+    };
+
+    struct InFlightUpload {
+	uint16_t texture_id;
+	std::pair<Image, VkImageView> texture;
+	uint64_t upload_value;
+    };
+
+    // A finished texture whose descriptor copies are rewritten one frame slot
+    // at a time, each right after that slot's fence is waited on.
+    struct PendingSwap {
+	uint16_t texture_id;
+	VkImageView view;
+	uint32_t written_frame_slots;
+    };
+
+    static const std::size_t UPLOAD_BUDGET_PER_FRAME = 1 << 25;
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable jobs_available;
+    std::deque<std::function<void()>> jobs;
+    std::vector<DecodedTexture> decoded_textures;
+    std::vector<DecodedTexture> upload_scratchpad;
+    std::vector<InFlightUpload> in_flight_uploads;
+    std::vector<PendingSwap> pending_swaps;
+    uint32_t num_pending = 0;
+    bool stopping = false;
+
+    // Bound in place of every streamed texture until its decode is uploaded,
+    // one per texture slot of a model: color, normal, packed material.
+    std::array<std::pair<Image, VkImageView>, 3> placeholder_textures;
+
+    auto enqueue(std::function<void()> &&job) noexcept -> void {
+	{
+	    std::lock_guard lock(mutex);
+	    jobs.emplace_back(std::move(job));
+	}
+	jobs_available.notify_one();
+    }
+
+    auto work() noexcept -> void {
+	while (true) {
+	    std::function<void()> job;
+	    {
+		std::unique_lock lock(mutex);
+		jobs_available.wait(lock, [this]() { return stopping || !jobs.empty(); });
+		if (stopping)
+		    return;
+		job = std::move(jobs.front());
+		jobs.pop_front();
+	    }
+	    job();
+	}
+    }
+
+    auto is_placeholder(VkImageView view) const noexcept -> bool {
+	for (const auto &placeholder : placeholder_textures)
+	    if (placeholder.second == view)
+		return true;
+	return false;
+    }
+};
+
+#endif
@@ -96,25 +96,23 @@ auto main([[maybe_unused]] int32_t argc, [[maybe_unused]] char **argv) noexcept
     const uint16_t test_voxel_model = context.load_voxel_model("dragon.obj", scene);
     scene.add_voxel_object(glm::rotate(glm::scale(glm::translate(glm::mat4(1), glm::vec3(0.0f, 0.0f, 5.0f)), glm::vec3(2.0f, 2.0f, 2.0f)), 1.0f, glm::vec3(0.0f, 0.2f, 0.8f)), test_voxel_model);
 
+    const uint16_t test_svo_model = context.load_svo_model("dragon.obj", scene);
+    scene.add_voxel_object(glm::rotate(glm::scale(glm::translate(glm::mat4(1), glm::vec3(0.0f, 0.0f, -5.0f)), glm::vec3(2.0f, 2.0f, 2.0f)), 1.0f, glm::vec3(0.0f, 0.2f, 0.8f)), test_svo_model);
+
     const uint16_t cloud_volumetric_model = context.load_volumetric_model("cloud", scene);
     scene.add_voxel_object(glm::rotate(glm::scale(glm::translate(glm::mat4(1), glm::vec3(0.0f, 0.0f, 10.0f)), glm::vec3(2.0f, 2.0f, 2.0f)), 1.0f, glm::vec3(0.0f, 0.2f, 0.8f)), cloud_volumetric_model);
     
     context.allocate_vulkan_objects_for_scene(scene);
-    context.build_bottom_level_acceleration_structure_for_model(model_id_dragon, scene);
-    context.build_bottom_level_acceleration_structure_for_model(model_id_red_dragon, scene);
-    context.build_bottom_level_acceleration_structure_for_model(model_id_blue_dragon, scene);
-    context.build_bottom_level_acceleration_structure_for_model(model_id_pico, scene);
-    context.build_bottom_level_acceleration_structure_for_model(model_id_floor, scene);
-    context.build_bottom_level_acceleration_structure_for_model(model_id_wall, scene);
-    context.build_bottom_level_acceleration_structure_for_voxel_model(test_voxel_model, scene);
-    context.build_bottom_level_acceleration_structure_for_voxel_model(cloud_volumetric_model, scene, false);
-    context.build_bottom_level_acceleration_structure_for_lights(scene);
+    const uint16_t model_ids[] = {model_id_dragon, model_id_red_dragon, model_id_blue_dragon, model_id_pico, model_id_floor, model_id_wall};
+    const uint16_t voxel_model_ids[] = {test_voxel_model, test_svo_model, cloud_volumetric_model};
+    context.build_bottom_level_acceleration_structures(model_ids, voxel_model_ids, scene);
     context.build_top_level_acceleration_structure_for_scene(scene);
     context.update_descriptors_tlas(scene);
     context.update_descriptors_ray_trace_objects(scene);
     context.update_descriptors_motion_vector_texture();
     context.update_descriptors_taa_images();
     context.update_descriptors_palettes(scene);
+    context.update_descriptors_svos(scene);
     context.update_descriptors_lights(scene);
     context.update_descriptors_perspective();
     
@@ -143,15 +141,15 @@ auto main([[maybe_unused]] int32_t argc, [[maybe_unused]] char **argv) noexcept
 	context.last_frame_camera_matrix = context.camera_matrix;
 	context.view_dir = glm::vec3(sin(context.camera_theta) * cos(context.camera_phi), sin(context.camera_theta) * sin(context.camera_phi), cos(context.camera_theta));
 	context.camera_matrix = glm::lookAt(context.camera_position, context.camera_position + context.view_dir, glm::vec3(0.0f, 0.0f, 1.0f));
-	context.push_constants.current_frame = context.current_frame;
-	context.push_constants.alpha_temporal = context.current_frame ? context.imgui_data.alpha_temporal : 0.0f;
-	context.push_constants.alpha_taa = context.current_frame ? context.imgui_data.alpha_taa : 0.0f;
-	context.push_constants.sigma_normal = context.imgui_data.sigma_normal;
-	context.push_constants.sigma_position = context.imgui_data.sigma_position;
-	context.push_constants.sigma_luminance = context.imgui_data.sigma_luminance;
-	context.push_constants.num_filter_iters = context.imgui_data.atrous_filter_iters + 1;
-	context.push_constants.temporal = context.imgui_data.temporal_filter;
-	context.push_constants.taa = context.imgui_data.taa;
+	context.frame_constants.current_frame = context.current_frame;
+	context.frame_constants.alpha_temporal = context.current_frame ? context.imgui_data.alpha_temporal : 0.0f;
+	context.frame_constants.alpha_taa = context.current_frame ? context.imgui_data.alpha_taa : 0.0f;
+	context.frame_constants.sigma_normal = context.imgui_data.sigma_normal;
+	context.frame_constants.sigma_position = context.imgui_data.sigma_position;
+	context.frame_constants.sigma_luminance = context.imgui_data.sigma_luminance;
+	context.frame_constants.num_filter_iters = context.imgui_data.atrous_filter_iters + 1;
+	context.frame_constants.temporal = context.imgui_data.temporal_filter;
+	context.frame_constants.taa = context.imgui_data.taa;
 	if (!context.is_using_imgui()) {
 	    const double mouse_dx = context.mouse_x - context.last_mouse_x;
 	    const double mouse_dy = context.mouse_y - context.last_mouse_y;
@@ -192,6 +190,8 @@ auto main([[maybe_unused]] int32_t argc, [[maybe_unused]] char **argv) noexcept
 	
 	context.ringbuffer_copy_scene_instances_into_buffer(scene);
 	context.ringbuffer_copy_scene_lights_into_buffer(scene);*/
+	context.upload_decoded_textures(scene);
+	context.update_top_level_acceleration_structure_for_scene(scene);
 	context.ringbuffer_copy_projection_matrices_into_buffer();
 	
 	context.render();
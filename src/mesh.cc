@@ -0,0 +1,323 @@
+/*
+ * This file is part of trace.
+ * trace is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ * trace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with trace. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <filesystem>
+#include <algorithm>
+#include <numeric>
+#include <atomic>
+#include <thread>
+#include <cfloat>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <tiny_obj_loader.h>
+
+#include "Tracy.hpp"
+
+#include "mesh.h"
+#include "util.h"
+
+static auto hash_source_path(std::string_view obj_filepath) noexcept -> uint64_t {
+    uint64_t hash = 0xCBF29CE484222325;
+    for (char c : obj_filepath) {
+	hash ^= (uint8_t) c;
+	hash *= 0x100000001B3;
+    }
+    return hash;
+}
+
+static auto source_mtime(std::string_view obj_filepath) noexcept -> int64_t {
+    std::error_code ec;
+    const auto mtime = std::filesystem::last_write_time(obj_filepath, ec);
+    return ec ? -1 : (int64_t) mtime.time_since_epoch().count();
+}
+
+// Hashes the bit patterns of a vertex, with -0.0 folded into 0.0 so that
+// vertices comparing equal always hash equal.
+static auto hash_vertex(const Model::Vertex &vertex) noexcept -> uint64_t {
+    const float components[8] = {
+	vertex.position.x + 0.0f, vertex.position.y + 0.0f, vertex.position.z + 0.0f,
+	vertex.normal.x + 0.0f, vertex.normal.y + 0.0f, vertex.normal.z + 0.0f,
+	vertex.texture.x + 0.0f, vertex.texture.y + 0.0f
+    };
+    uint64_t hash = 0x9E3779B97F4A7C15;
+    for (float component : components) {
+	uint32_t bits;
+	memcpy(&bits, &component, sizeof(uint32_t));
+	hash = (hash ^ bits) * 0xFF51AFD7ED558CCD;
+	hash ^= hash >> 32;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Linear probing table from vertex to its index in a welded vertex array.
+// Slots keep the upper hash bits so most probes never touch the vertices.
+struct VertexWeldTable {
+    static const uint32_t EMPTY = 0xFFFFFFFF;
+
+    struct Slot {
+	uint32_t tag;
+	uint32_t index;
+    };
+
+    std::vector<Slot> slots;
+    uint64_t mask;
+
+    VertexWeldTable(std::size_t max_entries) noexcept {
+	std::size_t capacity = 16;
+	while (capacity < max_entries * 2)
+	    capacity *= 2;
+	slots.assign(capacity, {0, EMPTY});
+	mask = capacity - 1;
+    }
+
+    auto weld(const Model::Vertex &vertex, std::vector<Model::Vertex> &vertices) noexcept -> uint32_t {
+	const uint64_t hash = hash_vertex(vertex);
+	const uint32_t tag = (uint32_t) (hash >> 32);
+	for (uint64_t slot_idx = hash & mask;; slot_idx = (slot_idx + 1) & mask) {
+	    Slot &slot = slots[slot_idx];
+	    if (slot.index == EMPTY) {
+		slot = {tag, (uint32_t) vertices.size()};
+		vertices.push_back(vertex);
+		return slot.index;
+	    }
+	    if (slot.tag == tag && vertices[slot.index] == vertex)
+		return slot.index;
+	}
+    }
+};
+
+auto parse_obj_model(std::string_view obj_filepath) noexcept -> Model {
+    ZoneScoped;
+    Model model {};
+
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string warn, err;
+    ASSERT(tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, &obj_filepath[0]), "Unable to load OBJ model.");
+
+    std::vector<std::size_t> shape_index_offsets(shapes.size() + 1, 0);
+    for (std::size_t shape_idx = 0; shape_idx < shapes.size(); ++shape_idx)
+	shape_index_offsets[shape_idx + 1] = shape_index_offsets[shape_idx] + shapes[shape_idx].mesh.indices.size();
+    model.indices.resize(shape_index_offsets.back());
+
+    // Weld each shape on its own thread, with indices local to the shape.
+    std::vector<std::vector<Model::Vertex>> shape_vertices(shapes.size());
+    std::atomic<std::size_t> next_shape = 0;
+    auto weld_shapes = [&]() {
+	for (std::size_t shape_idx = next_shape++; shape_idx < shapes.size(); shape_idx = next_shape++) {
+	    const auto &shape_indices = shapes[shape_idx].mesh.indices;
+	    VertexWeldTable table(shape_indices.size());
+	    for (std::size_t i = 0; i < shape_indices.size(); ++i) {
+		const auto &index = shape_indices[i];
+		const std::size_t count = shape_index_offsets[shape_idx] + i;
+		Model::Vertex vertex {};
+
+		vertex.position = {
+		    attrib.vertices[3 * index.vertex_index + 0],
+		    attrib.vertices[3 * index.vertex_index + 1],
+		    attrib.vertices[3 * index.vertex_index + 2]
+		};
+
+		if (index.normal_index >= 0) {
+		    vertex.normal = {
+			attrib.normals[3 * index.normal_index + 0],
+			attrib.normals[3 * index.normal_index + 1],
+			attrib.normals[3 * index.normal_index + 2]
+		    };
+		} else {
+		    ASSERT(false, "Model must contain vertex normals.");
+		}
+
+		if (index.texcoord_index >= 0) {
+		    vertex.texture = {
+			attrib.texcoords[2 * index.texcoord_index + 0],
+			1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
+		    };
+		} else {
+		    vertex.texture = {((float) count) / 1000.0f, ((float) count) / 1000.0f}; // Random texcoords for gradients in fragment shader
+		}
+
+		model.indices[count] = table.weld(vertex, shape_vertices[shape_idx]);
+	    }
+	}
+    };
+    const std::size_t num_threads = std::min<std::size_t>(shapes.size(), std::max(std::thread::hardware_concurrency(), 1U));
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < num_threads; ++i)
+	threads.emplace_back(weld_shapes);
+    weld_shapes();
+    for (auto &thread : threads)
+	thread.join();
+
+    // Shapes can share vertices along their seams, so weld once more across
+    // shapes, over the (much smaller) per shape unique vertices.
+    const std::size_t num_shape_vertices = std::accumulate(shape_vertices.begin(), shape_vertices.end(), (std::size_t) 0, [](std::size_t accum, const auto &vertices) { return accum + vertices.size(); });
+    VertexWeldTable seam_table(num_shape_vertices);
+    std::vector<uint32_t> remap;
+    for (std::size_t shape_idx = 0; shape_idx < shapes.size(); ++shape_idx) {
+	remap.resize(shape_vertices[shape_idx].size());
+	for (std::size_t i = 0; i < shape_vertices[shape_idx].size(); ++i)
+	    remap[i] = seam_table.weld(shape_vertices[shape_idx][i], model.vertices);
+	for (std::size_t i = shape_index_offsets[shape_idx]; i < shape_index_offsets[shape_idx + 1]; ++i)
+	    model.indices[i] = remap[model.indices[i]];
+    }
+
+    return model;
+}
+
+// Spreads the low 21 bits of x out to every third bit.
+static auto expand_morton_bits(uint64_t x) noexcept -> uint64_t {
+    x &= 0x1FFFFF;
+    x = (x | x << 32) & 0x1F00000000FFFF;
+    x = (x | x << 16) & 0x1F0000FF0000FF;
+    x = (x | x << 8) & 0x100F00F00F00F00F;
+    x = (x | x << 4) & 0x10C30C30C30C30C3;
+    x = (x | x << 2) & 0x1249249249249249;
+    return x;
+}
+
+auto optimize_mesh(Model &model) noexcept -> void {
+    ZoneScoped;
+    const std::size_t num_triangles = model.num_triangles();
+    if (num_triangles == 0)
+	return;
+
+    glm::vec3 bounds_min(FLT_MAX), bounds_max(-FLT_MAX);
+    for (const auto &vertex : model.vertices) {
+	bounds_min = glm::min(bounds_min, vertex.position);
+	bounds_max = glm::max(bounds_max, vertex.position);
+    }
+    const glm::vec3 extent = bounds_max - bounds_min;
+    const glm::vec3 scale = glm::vec3((float) 0x1FFFFF) / glm::max(extent, glm::vec3(FLT_MIN));
+
+    // Sort triangles along a Morton curve through their centroids, so
+    // triangles hit by neighbouring rays sit near each other in memory.
+    std::vector<std::pair<uint64_t, uint32_t>> keyed_triangles(num_triangles);
+    for (std::size_t triangle_idx = 0; triangle_idx < num_triangles; ++triangle_idx) {
+	const glm::vec3 centroid =
+	    (model.vertices[model.indices[3 * triangle_idx + 0]].position +
+	     model.vertices[model.indices[3 * triangle_idx + 1]].position +
+	     model.vertices[model.indices[3 * triangle_idx + 2]].position) / 3.0f;
+	const glm::uvec3 cell = glm::uvec3(glm::clamp((centroid - bounds_min) * scale, glm::vec3(0.0f), glm::vec3((float) 0x1FFFFF)));
+	const uint64_t morton = expand_morton_bits(cell.x) | expand_morton_bits(cell.y) << 1 | expand_morton_bits(cell.z) << 2;
+	keyed_triangles[triangle_idx] = {morton, (uint32_t) triangle_idx};
+    }
+    std::sort(keyed_triangles.begin(), keyed_triangles.end());
+
+    // Then renumber vertices in the order the sorted triangles first use them,
+    // so the three fetches per hit land close together.
+    std::vector<uint32_t> new_indices(model.indices.size());
+    std::vector<uint32_t> vertex_remap(model.vertices.size(), 0xFFFFFFFF);
+    std::vector<Model::Vertex> new_vertices;
+    new_vertices.reserve(model.vertices.size());
+    for (std::size_t triangle_idx = 0; triangle_idx < num_triangles; ++triangle_idx) {
+	for (std::size_t corner = 0; corner < 3; ++corner) {
+	    const uint32_t old_index = model.indices[3 * keyed_triangles[triangle_idx].second + corner];
+	    if (vertex_remap[old_index] == 0xFFFFFFFF) {
+		vertex_remap[old_index] = (uint32_t) new_vertices.size();
+		new_vertices.push_back(model.vertices[old_index]);
+	    }
+	    new_indices[3 * triangle_idx + corner] = vertex_remap[old_index];
+	}
+    }
+    model.vertices = std::move(new_vertices);
+    model.indices = std::move(new_indices);
+}
+
+auto mesh_cache_filepath(std::string_view obj_filepath) noexcept -> std::string {
+    return std::filesystem::path(obj_filepath).replace_extension(".mesh").string();
+}
+
+auto read_mesh_cache(std::string_view obj_filepath, Model &model) noexcept -> bool {
+    ZoneScoped;
+    const std::string cache_filepath = mesh_cache_filepath(obj_filepath);
+    const int fd = open(cache_filepath.c_str(), O_RDONLY);
+    if (fd == -1)
+	return false;
+    struct stat cache_stat;
+    if (fstat(fd, &cache_stat) == -1 || (std::size_t) cache_stat.st_size < sizeof(MeshCacheHeader)) {
+	close(fd);
+	return false;
+    }
+
+    const std::size_t file_size = (std::size_t) cache_stat.st_size;
+    void *mapped = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+	return false;
+
+    MeshCacheHeader header;
+    memcpy(&header, mapped, sizeof(MeshCacheHeader));
+    const std::size_t vertices_size = header.num_vertices * sizeof(Model::Vertex);
+    const std::size_t indices_size = header.num_indices * sizeof(uint32_t);
+    const bool valid =
+	header.magic == MeshCacheHeader::MAGIC &&
+	header.version == MeshCacheHeader::VERSION &&
+	header.source_path_hash == hash_source_path(obj_filepath) &&
+	header.source_mtime == source_mtime(obj_filepath) &&
+	file_size == sizeof(MeshCacheHeader) + vertices_size + indices_size;
+    if (valid) {
+	const char *vertices = (const char *) mapped + sizeof(MeshCacheHeader);
+	const char *indices = vertices + vertices_size;
+	model.vertices.resize(header.num_vertices);
+	model.indices.resize(header.num_indices);
+	memcpy(model.vertices.data(), vertices, vertices_size);
+	memcpy(model.indices.data(), indices, indices_size);
+    }
+    munmap(mapped, file_size);
+    return valid;
+}
+
+auto write_mesh_cache(std::string_view obj_filepath, const Model &model) noexcept -> bool {
+    ZoneScoped;
+    MeshCacheHeader header {};
+    header.magic = MeshCacheHeader::MAGIC;
+    header.version = MeshCacheHeader::VERSION;
+    header.source_path_hash = hash_source_path(obj_filepath);
+    header.source_mtime = source_mtime(obj_filepath);
+    header.num_vertices = model.vertices.size();
+    header.num_indices = model.indices.size();
+    header.bounds_min = glm::vec3(FLT_MAX);
+    header.bounds_max = glm::vec3(-FLT_MAX);
+    for (const auto &vertex : model.vertices) {
+	header.bounds_min = glm::min(header.bounds_min, vertex.position);
+	header.bounds_max = glm::max(header.bounds_max, vertex.position);
+    }
+
+    // Write to a temporary and rename over the cache, so a concurrent reader
+    // or an interrupted bake never sees a partial file.
+    const std::string cache_filepath = mesh_cache_filepath(obj_filepath);
+    const std::string temp_filepath = cache_filepath + ".tmp";
+    FILE *f = fopen(temp_filepath.c_str(), "w");
+    if (!f)
+	return false;
+    bool written = fwrite(&header, sizeof(MeshCacheHeader), 1, f) == 1;
+    written = written && fwrite(model.vertices.data(), sizeof(Model::Vertex), model.vertices.size(), f) == model.vertices.size();
+    written = written && fwrite(model.indices.data(), sizeof(uint32_t), model.indices.size(), f) == model.indices.size();
+    written = fclose(f) == 0 && written;
+    if (!written || rename(temp_filepath.c_str(), cache_filepath.c_str()) == -1) {
+	remove(temp_filepath.c_str());
+	return false;
+    }
+    return true;
+}
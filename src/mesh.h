@@ -0,0 +1,52 @@
+/*
+ * This file is part of trace.
+ * trace is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ * trace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with trace. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MESH_H
+#define MESH_H
+
+#include <string_view>
+#include <string>
+
+#include "model.h"
+
+// Baked meshes live next to their .obj as .mesh files: a header, then the
+// vertex array, then the index array, exactly as they're uploaded. A cache is
+// only used if it was baked from a source with the same path and mtime.
+struct MeshCacheHeader {
+    static const uint32_t MAGIC = 0x48534D54; // "TMSH"
+    static const uint32_t VERSION = 3;
+
+    uint32_t magic;
+    uint32_t version;
+    uint64_t source_path_hash;
+    int64_t source_mtime;
+    uint64_t num_vertices;
+    uint64_t num_indices;
+    glm::vec3 bounds_min;
+    glm::vec3 bounds_max;
+};
+
+auto parse_obj_model(std::string_view obj_filepath) noexcept -> Model;
+
+// Reorders triangles and vertices for memory locality. Run once, before
+// baking, so the cache stores the optimized order.
+auto optimize_mesh(Model &model) noexcept -> void;
+
+auto mesh_cache_filepath(std::string_view obj_filepath) noexcept -> std::string;
+
+auto read_mesh_cache(std::string_view obj_filepath, Model &model) noexcept -> bool;
+
+auto write_mesh_cache(std::string_view obj_filepath, const Model &model) noexcept -> bool;
+
+#endif
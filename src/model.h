@@ -16,6 +16,7 @@
 #define MODEL_H
 
 #include <cstring>
+#include <array>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -36,17 +37,47 @@ struct Model {
 	    return position == other.position && normal == other.normal && texture == other.texture;
 	}
     };
+
+    // The layout uploaded for hit shaders: full precision positions (also read
+    // by BLAS builds), octahedral normals as two snorm16s, and half float UVs.
+    struct PackedVertex {
+	glm::vec3 position;
+	uint32_t normal;
+	uint32_t texture;
+    };
+
+    static auto pack_vertex(const Vertex &vertex) noexcept -> PackedVertex {
+	const float l1_norm = glm::abs(vertex.normal.x) + glm::abs(vertex.normal.y) + glm::abs(vertex.normal.z);
+	const glm::vec3 n = l1_norm > 0.0f ? vertex.normal / l1_norm : glm::vec3(0.0f, 0.0f, 1.0f);
+	glm::vec2 oct = glm::vec2(n.x, n.y);
+	if (n.z < 0.0f) {
+	    const glm::vec2 sign_not_zero = glm::vec2(oct.x >= 0.0f ? 1.0f : -1.0f, oct.y >= 0.0f ? 1.0f : -1.0f);
+	    oct = (1.0f - glm::abs(glm::vec2(oct.y, oct.x))) * sign_not_zero;
+	}
+	return {vertex.position, glm::packSnorm2x16(oct), glm::packHalf2x16(vertex.texture)};
+    }
     
     std::vector<Vertex> vertices;
     std::vector<uint32_t> indices;
-    uint16_t base_texture_id;
+    // Color, normal and packed material slots in the bindless texture array.
+    std::array<uint16_t, 3> texture_ids;
 
     auto vertex_buffer_size() const noexcept -> std::size_t {
-	return vertices.size() * sizeof(Vertex);
+	return vertices.size() * sizeof(PackedVertex);
     }
 
+    // Meshes that can address every vertex with 16 bits upload 16 bit indices.
+    auto narrow_indices() const noexcept -> bool {
+	return vertices.size() <= 0x10000;
+    }
+
+    auto index_size() const noexcept -> std::size_t {
+	return narrow_indices() ? sizeof(uint16_t) : sizeof(uint32_t);
+    }
+
+    // Padded to 4 bytes, so every model's indices start word aligned.
     auto index_buffer_size() const noexcept -> std::size_t {
-	return indices.size() * sizeof(uint32_t);
+	return (indices.size() * index_size() + 3) & ~(std::size_t) 3;
     }
 
     auto num_vertices() const noexcept -> uint32_t {
@@ -62,18 +93,24 @@ struct Model {
     }
 
     auto dump_vertices(char *dst) const noexcept -> void {
-	memcpy(dst, vertices.data(), vertices.size() * sizeof(Vertex));
+	PackedVertex *packed = (PackedVertex *) dst;
+	for (const auto &vertex : vertices)
+	    *(packed++) = pack_vertex(vertex);
     }
 
     auto dump_indices(char *dst) const noexcept -> void {
-	memcpy(dst, indices.data(), indices.size() * sizeof(uint32_t));
+	if (narrow_indices()) {
+	    uint16_t *narrow = (uint16_t *) dst;
+	    for (uint32_t index : indices)
+		*(narrow++) = (uint16_t) index;
+	    memset(narrow, 0, index_buffer_size() - indices.size() * sizeof(uint16_t));
+	} else {
+	    memcpy(dst, indices.data(), indices.size() * sizeof(uint32_t));
+	}
     }
 
-    auto get_texture_ids() const noexcept -> std::array<uint16_t, 4> {
-	return {base_texture_id,
-		(uint16_t) (base_texture_id + 1),
-		(uint16_t) (base_texture_id + 2),
-		(uint16_t) (base_texture_id + 3)};
+    auto get_texture_ids() const noexcept -> std::array<uint16_t, 3> {
+	return texture_ids;
     }
 };
 
@@ -237,6 +237,8 @@ auto RenderContext::create_ray_trace_pipeline() noexcept -> void {
     VkShaderModule light_rint_shader = shader_modules["light_rint"];
     VkShaderModule volumetric_rchit_shader = shader_modules["volumetric_rchit"];
     VkShaderModule volumetric_rint_shader = shader_modules["volumetric_rint"];
+    VkShaderModule svo_rchit_shader = shader_modules["svo_rchit"];
+    VkShaderModule svo_rint_shader = shader_modules["svo_rint"];
 
     VkPipelineShaderStageCreateInfo rgen_shader_stage_create_info {};
     rgen_shader_stage_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -292,6 +294,18 @@ auto RenderContext::create_ray_trace_pipeline() noexcept -> void {
     volumetric_rint_shader_stage_create_info.module = volumetric_rint_shader;
     volumetric_rint_shader_stage_create_info.pName = "main";
 
+    VkPipelineShaderStageCreateInfo svo_rchit_shader_stage_create_info {};
+    svo_rchit_shader_stage_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    svo_rchit_shader_stage_create_info.stage = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
+    svo_rchit_shader_stage_create_info.module = svo_rchit_shader;
+    svo_rchit_shader_stage_create_info.pName = "main";
+
+    VkPipelineShaderStageCreateInfo svo_rint_shader_stage_create_info {};
+    svo_rint_shader_stage_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    svo_rint_shader_stage_create_info.stage = VK_SHADER_STAGE_INTERSECTION_BIT_KHR;
+    svo_rint_shader_stage_create_info.module = svo_rint_shader;
+    svo_rint_shader_stage_create_info.pName = "main";
+
     VkPipelineShaderStageCreateInfo shader_stage_create_infos[] =
 	{
 	    rgen_shader_stage_create_info,
@@ -302,7 +316,9 @@ auto RenderContext::create_ray_trace_pipeline() noexcept -> void {
 	    light_rchit_shader_stage_create_info,
 	    light_rint_shader_stage_create_info,
 	    volumetric_rchit_shader_stage_create_info,
-	    volumetric_rint_shader_stage_create_info
+	    volumetric_rint_shader_stage_create_info,
+	    svo_rchit_shader_stage_create_info,
+	    svo_rint_shader_stage_create_info
 	};
 
     VkRayTracingShaderGroupCreateInfoKHR shader_group_create_info {};
@@ -343,6 +359,12 @@ auto RenderContext::create_ray_trace_pipeline() noexcept -> void {
     shader_group_create_info.intersectionShader = 8;
     ray_trace_shader_groups.push_back(shader_group_create_info);
 
+    shader_group_create_info.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_PROCEDURAL_HIT_GROUP_KHR;
+    shader_group_create_info.generalShader = VK_SHADER_UNUSED_KHR;
+    shader_group_create_info.closestHitShader = 9;
+    shader_group_create_info.intersectionShader = 10;
+    ray_trace_shader_groups.push_back(shader_group_create_info);
+
     VkPushConstantRange push_constant_range {};
     push_constant_range.offset = 0;
     push_constant_range.size = sizeof(PushConstants);
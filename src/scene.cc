@@ -13,13 +13,16 @@
  */
 
 #include <filesystem>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <bit>
 
-#include <tiny_obj_loader.h>
-
 #include "Tracy.hpp"
 
 #include "context.h"
+#include "mesh.h"
+#include "texture.h"
 
 auto RenderContext::allocate_vulkan_objects_for_scene(Scene &scene) noexcept -> void {
     ZoneScoped;
@@ -34,6 +37,7 @@ auto RenderContext::allocate_vulkan_objects_for_scene(Scene &scene) noexcept ->
     std::size_t index_idx = 0;
     const std::size_t index_size = std::accumulate(scene.models.begin(), scene.models.end(), 0, [&scene, &index_idx](const std::size_t &accum, const Model &model) { scene.model_indices_offsets[index_idx++] = accum; return accum + model.index_buffer_size(); });
     scene.indices_buf_contents_size = index_size;
+    share_mesh_offsets(scene);
     scene.indices_buf = create_buffer(index_size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "SCENE_INDICES_BUFFER");
 
     const std::size_t instance_size = scene.num_objects * sizeof(glm::mat4);
@@ -60,6 +64,10 @@ auto RenderContext::allocate_vulkan_objects_for_scene(Scene &scene) noexcept ->
     scene.light_aabbs_buf_contents_size = light_aabbs_size;
     scene.light_aabbs_buf = create_buffer(light_aabbs_size, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "LIGHT_AABBS_BUFFER");
 
+    const std::size_t svo_size = (Scene::MAX_SVO_MODELS + scene.svo_nodes.size()) * sizeof(uint32_t);
+    scene.svo_buf_contents_size = svo_size;
+    scene.svo_buf = create_buffer(svo_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "SCENE_SVO_BUFFER");
+
     ringbuffer_copy_scene_vertices_into_buffer(scene);
     ringbuffer_copy_scene_indices_into_buffer(scene);
     ringbuffer_copy_scene_instances_into_buffer(scene);
@@ -68,6 +76,7 @@ auto RenderContext::allocate_vulkan_objects_for_scene(Scene &scene) noexcept ->
     ringbuffer_copy_scene_ray_trace_objects_into_buffer(scene);
     ringbuffer_copy_scene_voxel_palettes_into_buffer(scene);
     ringbuffer_copy_scene_light_aabbs_into_buffer(scene);
+    ringbuffer_copy_scene_svos_into_buffer(scene);
 }
 
 auto RenderContext::update_vulkan_objects_for_scene(Scene &scene) noexcept -> void {
@@ -82,6 +91,7 @@ auto RenderContext::update_vulkan_objects_for_scene(Scene &scene) noexcept -> vo
     std::size_t index_idx = 0;
     const std::size_t index_size = std::accumulate(scene.models.begin(), scene.models.end(), 0, [&scene, &index_idx](const std::size_t &accum, const Model &model) { scene.model_indices_offsets[index_idx++] = accum; return accum + model.index_buffer_size(); });
     scene.indices_buf_contents_size = index_size;
+    share_mesh_offsets(scene);
 
     const std::size_t instance_size = scene.num_objects * sizeof(glm::mat4);
     scene.instances_buf_contents_size = instance_size;
@@ -101,6 +111,9 @@ auto RenderContext::update_vulkan_objects_for_scene(Scene &scene) noexcept -> vo
     const std::size_t light_aabbs_size = scene.num_lights * sizeof(VkAabbPositionsKHR);
     scene.light_aabbs_buf_contents_size = light_aabbs_size;
 
+    const std::size_t svo_size = (Scene::MAX_SVO_MODELS + scene.svo_nodes.size()) * sizeof(uint32_t);
+    scene.svo_buf_contents_size = svo_size;
+
     ringbuffer_copy_scene_vertices_into_buffer(scene);
     ringbuffer_copy_scene_indices_into_buffer(scene);
     ringbuffer_copy_scene_instances_into_buffer(scene);
@@ -109,6 +122,7 @@ auto RenderContext::update_vulkan_objects_for_scene(Scene &scene) noexcept -> vo
     ringbuffer_copy_scene_ray_trace_objects_into_buffer(scene);
     ringbuffer_copy_scene_voxel_palettes_into_buffer(scene);
     ringbuffer_copy_scene_light_aabbs_into_buffer(scene);
+    ringbuffer_copy_scene_svos_into_buffer(scene);
 }
 
 auto RenderContext::cleanup_vulkan_objects_for_scene(Scene &scene) noexcept -> void {
@@ -121,29 +135,44 @@ auto RenderContext::cleanup_vulkan_objects_for_scene(Scene &scene) noexcept -> v
     cleanup_buffer(scene.ray_trace_objects_buf);
     cleanup_buffer(scene.voxel_palette_buf);
     cleanup_buffer(scene.light_aabbs_buf);
+    cleanup_buffer(scene.svo_buf);
     for (auto image : scene.textures) {
+	if (asset_loader.is_placeholder(image.second))
+	    continue;
 	cleanup_image_view(image.second);
 	cleanup_image(image.first);
     }
     for (auto volume : scene.voxel_volumes) {
+	if (!volume.first.allocation)
+	    continue;
 	cleanup_image_view(volume.second);
 	cleanup_volume(volume.first);
     }
-    vkDestroyAccelerationStructureKHR(device, scene.tlas, NULL);
-    cleanup_buffer(scene.tlas_buffer);
-    cleanup_buffer(scene.tlas_instances_buffer);
+    cleanup_top_level_acceleration_structure_for_scene(scene);
     vkDestroyAccelerationStructureKHR(device, scene.lights_blas, NULL);
     cleanup_buffer(scene.lights_blas_buffer);
-    for (auto blas : scene.blass)
-	vkDestroyAccelerationStructureKHR(device, blas, NULL);
-    for (auto buffer : scene.blas_buffers)
-	cleanup_buffer(buffer);
+    for (uint16_t model_idx = 0; model_idx < scene.num_models; ++model_idx) {
+	if (scene.model_mesh_ids[model_idx] != model_idx)
+	    continue;
+	vkDestroyAccelerationStructureKHR(device, scene.blass[model_idx], NULL);
+	cleanup_buffer(scene.blas_buffers[model_idx]);
+    }
     for (auto blas : scene.voxel_blass)
 	vkDestroyAccelerationStructureKHR(device, blas, NULL);
     for (auto buffer : scene.voxel_blas_buffers)
 	cleanup_buffer(buffer);
 }
 
+auto RenderContext::share_mesh_offsets(Scene &scene) noexcept -> void {
+    ZoneScoped;
+    // Material variants carry no geometry of their own; point them at the model
+    // that owns their mesh. Owners always precede their variants.
+    for (uint16_t model_idx = 0; model_idx < scene.num_models; ++model_idx) {
+	scene.model_vertices_offsets[model_idx] = scene.model_vertices_offsets[scene.model_mesh_ids[model_idx]];
+	scene.model_indices_offsets[model_idx] = scene.model_indices_offsets[scene.model_mesh_ids[model_idx]];
+    }
+}
+
 auto RenderContext::ringbuffer_copy_scene_vertices_into_buffer(Scene &scene) noexcept -> void {
     ZoneScoped;
     char *data_vertex = (char *) ringbuffer_claim_buffer(main_ring_buffer, scene.vertices_buf_contents_size);
@@ -181,10 +210,11 @@ auto RenderContext::ringbuffer_copy_scene_indirect_draw_into_buffer(Scene &scene
     for (std::size_t i = 0; i < scene.num_models; ++i) {
 	const std::size_t vertex_buffer_model_offset = scene.model_vertices_offsets[i];
 	const std::size_t index_buffer_model_offset = scene.model_indices_offsets[i];
-	data_indirect_draw[i].indexCount = scene.models[i].num_indices();
+	const Model &mesh = scene.models[scene.model_mesh_ids[i]];
+	data_indirect_draw[i].indexCount = mesh.num_indices();
 	data_indirect_draw[i].instanceCount = (uint32_t) scene.transforms[i].size();
-	data_indirect_draw[i].firstIndex = (uint32_t) index_buffer_model_offset / sizeof(uint32_t);
-	data_indirect_draw[i].vertexOffset = (int32_t) vertex_buffer_model_offset / sizeof(Model::Vertex);
+	data_indirect_draw[i].firstIndex = (uint32_t) (index_buffer_model_offset / mesh.index_size());
+	data_indirect_draw[i].vertexOffset = (int32_t) vertex_buffer_model_offset / sizeof(Model::PackedVertex);
 	data_indirect_draw[i].firstInstance = num_instances_so_far;
 	num_instances_so_far += (uint32_t) scene.transforms[i].size();
     }
@@ -208,7 +238,10 @@ auto RenderContext::ringbuffer_copy_scene_ray_trace_objects_into_buffer(Scene &s
 	for (std::size_t j = 0; j < scene.transforms[i].size(); ++j) {
 	    data_ray_trace_object->vertex_address = vertex_buffer_address + scene.model_vertices_offsets[i];
 	    data_ray_trace_object->index_address = index_buffer_address + scene.model_indices_offsets[i];
-	    data_ray_trace_object->model_id = i;
+	    data_ray_trace_object->model_id = (uint32_t) i;
+	    data_ray_trace_object->narrow_indices = scene.models[scene.model_mesh_ids[i]].narrow_indices();
+	    for (uint32_t k = 0; k < 3; ++k)
+		data_ray_trace_object->texture_ids[k] = scene.models[i].texture_ids[k];
 	    ++data_ray_trace_object;
 	}
     }
@@ -240,6 +273,15 @@ auto RenderContext::ringbuffer_copy_scene_light_aabbs_into_buffer(Scene &scene)
     ringbuffer_submit_buffer(main_ring_buffer, scene.light_aabbs_buf);
 }
 
+auto RenderContext::ringbuffer_copy_scene_svos_into_buffer(Scene &scene) noexcept -> void {
+    ZoneScoped;
+    uint32_t *data_svo = (uint32_t *) ringbuffer_claim_buffer(main_ring_buffer, scene.svo_buf_contents_size);
+    memset(data_svo, 0xFF, Scene::MAX_SVO_MODELS * sizeof(uint32_t));
+    memcpy(data_svo, scene.voxel_svo_offsets.data(), scene.num_voxel_models * sizeof(uint32_t));
+    memcpy(data_svo + Scene::MAX_SVO_MODELS, scene.svo_nodes.data(), scene.svo_nodes.size() * sizeof(uint32_t));
+    ringbuffer_submit_buffer(main_ring_buffer, scene.svo_buf);
+}
+
 const glm::vec2 quincunx[5] = {
     glm::vec2(0.5, 0.5),
     glm::vec2(-0.5, -0.5),
@@ -279,6 +321,7 @@ auto RenderContext::ringbuffer_copy_projection_matrices_into_buffer() noexcept -
     *((glm::vec3 *) &data_vec[5]) = last_frame_view_dir;
     *((glm::vec3 *) &data_vec[6]) = glm::normalize(glm::cross(last_frame_view_dir, glm::vec3(0.0f, 0.0f, 1.0f)));
     *((glm::vec3 *) &data_vec[7]) = glm::cross(last_frame_view_dir, *((glm::vec3 *) &data_vec[6]));
+    memcpy((char *) data_mat + FRAME_CONSTANTS_OFFSET, &frame_constants, sizeof(FrameConstants));
     ringbuffer_submit_buffer(main_ring_buffer, projection_buffer);
 }
 
@@ -300,57 +343,54 @@ auto RenderContext::load_model(std::string_view model_name, Scene &scene, const
 	std::string("models/") +
 	std::string(model_name) +
 	std::string("PBRNORMAL.png");
-    std::string rough_filepath =
-	std::string("models/") +
-	std::string(model_name) +
-	std::string("PBRROUGH.png");
-    std::string metal_filepath =
-	std::string("models/") +
-	std::string(model_name) +
-	std::string("PBRMETAL.png");
 
     if (!std::filesystem::exists(color_filepath)) color_filepath = "models/DEFAULTPBRCOLOR.png";
     if (!std::filesystem::exists(normal_filepath)) normal_filepath = "models/DEFAULTPBRNORMAL.png";
-    if (!std::filesystem::exists(rough_filepath)) rough_filepath = "models/DEFAULTPBRROUGH.png";
-    if (!std::filesystem::exists(metal_filepath)) metal_filepath = "models/DEFAULTPBRMETAL.png";
 
     if (std::filesystem::exists(obj_filepath)) {
 	const uint16_t model_id = scene.num_models;
-	const uint16_t base_texture_id = scene.num_textures;
 
-	scene.models.emplace_back(load_obj_model(obj_filepath));
+	// Every model id with the same .obj shares one mesh and one BLAS, and only
+	// differs in the textures its instances select through their ray trace object.
+	uint16_t mesh_id = model_id;
+	auto mesh_it = scene.loaded_meshes.find(obj_filepath);
+	if (mesh_it != scene.loaded_meshes.end()) {
+	    mesh_id = mesh_it->second;
+	    scene.models.emplace_back();
+	} else {
+	    scene.models.emplace_back(load_obj_model(obj_filepath));
+	    scene.loaded_meshes.insert({obj_filepath, model_id});
+	}
+	scene.model_mesh_ids.push_back(mesh_id);
+	const MaterialTexturePaths material_paths = material_texture_paths(obj_filepath);
+	std::array<uint16_t, 3> &texture_ids = scene.models.back().texture_ids;
 	if (custom_mat) {
-	    auto mat = load_custom_material(custom_mat[0], custom_mat[1], custom_mat[2], custom_mat[3], custom_mat[4], 0xD);
-	    scene.textures.emplace_back(mat[0]);
-	    scene.textures.emplace_back(load_texture(normal_filepath, false));
-	    scene.textures.emplace_back(mat[2]);
-	    scene.textures.emplace_back(mat[3]);
+	    texture_ids[0] = find_or_load_solid_texture(scene, {custom_mat[0], custom_mat[1], custom_mat[2], 255}, true);
+	    texture_ids[2] = find_or_load_solid_texture(scene, {custom_mat[3], custom_mat[4], 255, 255}, false);
 	} else {
-	    scene.textures.emplace_back(load_texture(color_filepath, true));
-	    scene.textures.emplace_back(load_texture(normal_filepath, false));
-	    scene.textures.emplace_back(load_texture(rough_filepath, false));
-	    scene.textures.emplace_back(load_texture(metal_filepath, false));
+	    texture_ids[0] = find_or_load_texture(scene, "file " + color_filepath, [&](uint16_t texture_id) { return load_texture_async(color_filepath, true, texture_id); });
+	    const std::string material_key = "material " + material_paths.roughness + " " + material_paths.metallicity;
+	    texture_ids[2] = find_or_load_texture(scene, material_key, [&](uint16_t texture_id) { return load_material_texture_async(obj_filepath, texture_id); });
 	}
+	texture_ids[1] = find_or_load_texture(scene, "file " + normal_filepath, [&](uint16_t texture_id) { return load_texture_async(normal_filepath, false, texture_id); });
 	scene.num_models += 1;
-	scene.num_textures += 4;
 	scene.transforms.emplace_back();
 	scene.blass.push_back(VK_NULL_HANDLE);
 	scene.blas_buffers.emplace_back();
-	scene.models.back().base_texture_id = base_texture_id;
-
-	update_descriptors_textures(scene, base_texture_id);
-	update_descriptors_textures(scene, base_texture_id + 1);
-	update_descriptors_textures(scene, base_texture_id + 2);
-	update_descriptors_textures(scene, base_texture_id + 3);
 	
 	if (!custom_mat)
 	    scene.loaded_models.insert({std::string(model_name), model_id});
 
-	std::cout << "INFO: Loaded model " << obj_filepath << ", with " << scene.models.back().vertices.size() << " vertices and " << scene.models.back().indices.size() << " indices.\n";
+	if (mesh_id == model_id)
+	    std::cout << "INFO: Loaded model " << obj_filepath << ", with " << scene.models.back().vertices.size() << " vertices and " << scene.models.back().indices.size() << " indices.\n";
+	else
+	    std::cout << "INFO: Loaded material variant of model " << obj_filepath << ", sharing the mesh of model " << mesh_id << ".\n";
 	std::cout << "INFO: Used PBR color texture at " << color_filepath << ".\n";
 	std::cout << "INFO: Used PBR normal texture at " << normal_filepath << ".\n";
-	std::cout << "INFO: Used PBR roughness texture at " << rough_filepath << ".\n";
-	std::cout << "INFO: Used PBR metallicity texture at " << metal_filepath << ".\n";
+	if (!custom_mat) {
+	    std::cout << "INFO: Used PBR roughness texture at " << material_paths.roughness << ".\n";
+	    std::cout << "INFO: Used PBR metallicity texture at " << material_paths.metallicity << ".\n";
+	}
 	return model_id;
     } else {
 	ASSERT(false, "Couldn't find model with given name. Currently, only .obj models are supported.");
@@ -361,78 +401,33 @@ auto RenderContext::load_model(std::string_view model_name, Scene &scene, const
 auto RenderContext::load_obj_model(std::string_view obj_filepath) noexcept -> Model {
     ZoneScoped;
     Model model {};
-
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-    std::string warn, err;
-    ASSERT(tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, &obj_filepath[0]), "Unable to load OBJ model.");
-
-    std::unordered_map<Model::Vertex, uint32_t> unique_vertices;
-
-    uint32_t count = 0;
-    for (const auto& shape : shapes) {
-	for (const auto& index : shape.mesh.indices) {
-	    Model::Vertex vertex {};
-
-	    vertex.position = {
-		attrib.vertices[3 * index.vertex_index + 0],
-		attrib.vertices[3 * index.vertex_index + 1],
-		attrib.vertices[3 * index.vertex_index + 2]
-	    };
-	    
-	    if (index.normal_index >= 0) {
-		vertex.normal = {
-		    attrib.normals[3 * index.normal_index + 0],
-		    attrib.normals[3 * index.normal_index + 1],
-		    attrib.normals[3 * index.normal_index + 2]
-		};
-	    } else {
-		ASSERT(false, "Model must contain vertex normals.");
-	    }
-	    
-	    if (index.texcoord_index >= 0) {
-		vertex.texture = {
-		    attrib.texcoords[2 * index.texcoord_index + 0],
-		    1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-		};
-	    } else {
-		vertex.texture = {((float) count) / 1000.0f, ((float) count) / 1000.0f}; // Random texcoords for gradients in fragment shader
-	    }
-	    
-	    model.vertices.push_back(vertex);
-	    if (unique_vertices.count(vertex) == 0) {
-		unique_vertices[vertex] = (uint32_t) model.vertices.size();
-		model.vertices.push_back(vertex);
-	    }
-	    model.indices.push_back(unique_vertices[vertex]);
-	    ++count;
-	}
+    if (read_mesh_cache(obj_filepath, model)) {
+	std::cout << "INFO: Read baked mesh " << mesh_cache_filepath(obj_filepath) << ".\n";
+	return model;
     }
-    
+
+    model = parse_obj_model(obj_filepath);
+    optimize_mesh(model);
+    if (write_mesh_cache(obj_filepath, model))
+	std::cout << "INFO: Baked mesh " << mesh_cache_filepath(obj_filepath) << ".\n";
+    else
+	std::cout << "WARNING: Couldn't bake mesh " << mesh_cache_filepath(obj_filepath) << ".\n";
     return model;
 }
 
-auto RenderContext::load_texture(std::string_view texture_filepath, bool srgb) noexcept -> std::pair<Image, VkImageView> {
+auto RenderContext::upload_texture(RingBuffer &ring_buffer, const uint8_t *data, VkFormat format, VkExtent2D extent, uint32_t mip_levels) noexcept -> std::pair<Image, VkImageView> {
     ZoneScoped;
-    int tex_width, tex_height, tex_channels;
-    stbi_uc* pixels = stbi_load(&texture_filepath[0], &tex_width, &tex_height, &tex_channels, STBI_rgb_alpha);
-
-    ASSERT(pixels, "Unable to load texture.");
-    std::size_t image_size = tex_width * tex_height * 4;
+    const std::size_t image_size = texture_size(format, extent, mip_levels);
+    Image dst = create_image(0, format, extent, mip_levels, 1, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "TEXTURE_IMAGE");
 
-    VkFormat format = srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
-    VkExtent2D extent = {(uint32_t) tex_width, (uint32_t) tex_height};
-    Image dst = create_image(0, format, extent, 1, 1, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "TEXTURE_IMAGE");
-
-    void *data_image = ringbuffer_claim_buffer(main_ring_buffer, image_size);
-    memcpy(data_image, pixels, image_size);
-    ringbuffer_submit_buffer(main_ring_buffer, dst, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    void *data_image = ringbuffer_claim_buffer(ring_buffer, image_size);
+    memcpy(data_image, data, image_size);
+    ringbuffer_submit_buffer(ring_buffer, dst, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
     VkImageSubresourceRange subresource_range {};
     subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     subresource_range.baseMipLevel = 0;
-    subresource_range.levelCount = 1;
+    subresource_range.levelCount = mip_levels;
     subresource_range.baseArrayLayer = 0;
     subresource_range.layerCount = 1;
 
@@ -468,62 +463,78 @@ auto RenderContext::load_image(std::string_view texture_filepath) noexcept -> st
 auto RenderContext::load_custom_model(const std::vector<Model::Vertex> &vertices, const std::vector<uint32_t> &indices, uint8_t red_albedo, uint8_t green_albedo, uint8_t blue_albedo, uint8_t roughness, uint8_t metallicity, Scene &scene) noexcept -> uint16_t {
     ZoneScoped;
     const uint16_t model_id = scene.num_models;
-    const uint16_t base_texture_id = scene.num_textures;
-
-    const auto mat = load_custom_material(red_albedo, green_albedo, blue_albedo, roughness, metallicity);
-    scene.textures.emplace_back(mat[0]);
-    scene.textures.emplace_back(mat[1]);
-    scene.textures.emplace_back(mat[2]);
-    scene.textures.emplace_back(mat[3]);
-    update_descriptors_textures(scene, base_texture_id);
-    update_descriptors_textures(scene, base_texture_id + 1);
-    update_descriptors_textures(scene, base_texture_id + 2);
-    update_descriptors_textures(scene, base_texture_id + 3);
-    
-    scene.models.emplace_back(vertices, indices, base_texture_id);
+
+    const std::array<uint16_t, 3> texture_ids = {
+	find_or_load_solid_texture(scene, {red_albedo, green_albedo, blue_albedo, 255}, true),
+	find_or_load_solid_texture(scene, {128, 128, 255, 255}, false),
+	find_or_load_solid_texture(scene, {roughness, metallicity, 255, 255}, false)
+    };
+    scene.models.emplace_back(vertices, indices, texture_ids);
+    scene.model_mesh_ids.push_back(model_id);
 
     scene.num_models += 1;
-    scene.num_textures += 4;
     scene.transforms.emplace_back();
     scene.blass.push_back(VK_NULL_HANDLE);
     scene.blas_buffers.emplace_back();
     return model_id;
 }
 
-auto RenderContext::load_custom_material(uint8_t red_albedo, uint8_t green_albedo, uint8_t blue_albedo, uint8_t roughness, uint8_t metallicity, uint8_t mask) noexcept -> std::array<std::pair<Image, VkImageView>, 4> {
+auto RenderContext::load_custom_material(uint8_t red_albedo, uint8_t green_albedo, uint8_t blue_albedo, uint8_t roughness, uint8_t metallicity, uint8_t mask) noexcept -> std::array<std::pair<Image, VkImageView>, 3> {
+    ZoneScoped;
+    const std::array<std::array<uint8_t, 4>, 3> contents = {{
+	{red_albedo, green_albedo, blue_albedo, 255},
+	{128, 128, 255, 255},
+	{roughness, metallicity, 255, 255}
+    }};
+    std::array<std::pair<Image, VkImageView>, 3> ret;
+
+    for (uint16_t i = 0; i < 3; ++i)
+	if (mask & (1 << i))
+	    ret[i] = load_solid_texture(contents[i], !i);
+
+    return ret;
+}
+
+auto RenderContext::load_solid_texture(std::array<uint8_t, 4> rgba, bool srgb) noexcept -> std::pair<Image, VkImageView> {
     ZoneScoped;
     std::size_t image_size = 4;
-    std::array<uint8_t, 16> contents = {
-	red_albedo, green_albedo, blue_albedo, 255,
-	128, 128, 255, 255,
-	roughness, roughness, roughness, 255,
-	metallicity, metallicity, metallicity, 255
-    };
-    std::array<std::pair<Image, VkImageView>, 4> ret;
+    VkFormat format = srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+    VkExtent2D extent = {1, 1};
+    Image dst = create_image(0, format, extent, 1, 1, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "CUSTOM_MATERIAL_IMAGE");
 
-    for (uint16_t i = 0; i < 4; ++i) {
-	if (!(mask & (1 << i)))
-	    continue;
-	
-	VkFormat format = !i ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
-	VkExtent2D extent = {1, 1};
-	Image dst = create_image(0, format, extent, 1, 1, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "CUSTOM_MATERIAL_IMAGE");
+    void *data_image = ringbuffer_claim_buffer(main_ring_buffer, image_size);
+    memcpy(data_image, rgba.data(), image_size);
+    ringbuffer_submit_buffer(main_ring_buffer, dst, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
-	void *data_image = ringbuffer_claim_buffer(main_ring_buffer, image_size);
-	memcpy(data_image, &contents[i * 4], image_size);
-	ringbuffer_submit_buffer(main_ring_buffer, dst, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-	
-	VkImageSubresourceRange subresource_range {};
-	subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	subresource_range.baseMipLevel = 0;
-	subresource_range.levelCount = 1;
-	subresource_range.baseArrayLayer = 0;
-	subresource_range.layerCount = 1;
-	
-	ret[i] = {dst, create_image_view(dst.image, format, subresource_range)};
-    }
+    VkImageSubresourceRange subresource_range {};
+    subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    subresource_range.baseMipLevel = 0;
+    subresource_range.levelCount = 1;
+    subresource_range.baseArrayLayer = 0;
+    subresource_range.layerCount = 1;
 
-    return ret;
+    return {dst, create_image_view(dst.image, format, subresource_range)};
+}
+
+auto RenderContext::find_or_load_texture(Scene &scene, const std::string &key, const std::function<std::pair<Image, VkImageView>(uint16_t)> &load) noexcept -> uint16_t {
+    ZoneScoped;
+    auto it = scene.loaded_textures.find(key);
+    if (it != scene.loaded_textures.end())
+	return it->second;
+
+    const uint16_t texture_id = scene.num_textures;
+    scene.textures.emplace_back(load(texture_id));
+    scene.num_textures += 1;
+    update_descriptors_textures(scene, texture_id);
+    scene.loaded_textures.insert({key, texture_id});
+    return texture_id;
+}
+
+auto RenderContext::find_or_load_solid_texture(Scene &scene, std::array<uint8_t, 4> rgba, bool srgb) noexcept -> uint16_t {
+    ZoneScoped;
+    char key[32];
+    snprintf(key, sizeof(key), "solid %02x%02x%02x%02x %s", rgba[0], rgba[1], rgba[2], rgba[3], srgb ? "srgb" : "unorm");
+    return find_or_load_texture(scene, key, [&](uint16_t) { return load_solid_texture(rgba, srgb); });
 }
 
 auto RenderContext::load_voxel_model(std::string_view model_name, Scene &scene) noexcept -> uint16_t {
@@ -543,9 +554,10 @@ auto RenderContext::load_voxel_model(std::string_view model_name, Scene &scene)
 	
 	++scene.num_voxel_models;
 	scene.voxel_transforms.emplace_back();
+	scene.voxel_svo_offsets.push_back(Scene::NO_SVO);
 	scene.voxel_blass.push_back(VK_NULL_HANDLE);
 	scene.voxel_blas_buffers.emplace_back();
-	scene.solid_or_volumetric.emplace_back();
+	scene.solid_or_volumetric.push_back(true);
 
 	update_descriptors_volumes(scene, voxel_model_id);
 
@@ -640,26 +652,154 @@ auto RenderContext::load_dot_bin_model(std::string_view bin_filepath) noexcept -
 
 auto RenderContext::upload_voxel_model(const VoxelModel &voxel_model) noexcept -> std::pair<Volume, VkImageView> {
     ZoneScoped;
-    std::size_t volume_size = voxel_model.x_len * voxel_model.y_len * voxel_model.z_len;
-
     VkFormat format = VK_FORMAT_R8_UNORM;
     VkExtent3D extent =  {voxel_model.x_len, voxel_model.y_len, voxel_model.z_len};
-    Volume dst = create_volume(0, format, extent, 1, 1, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_STORAGE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "VOLUME_IMAGE");
 
-    void *data_image = ringbuffer_claim_buffer(main_ring_buffer, volume_size);
-    memcpy(data_image, voxel_model.voxels.data(), volume_size);
-    ringbuffer_submit_buffer(main_ring_buffer, dst, VK_IMAGE_LAYOUT_GENERAL);
+    // Mip 0 holds the palette indices (or densities), and every mip above it is a
+    // max-reduced occupancy level that the intersection shaders use to skip empty
+    // space. The last cell along each axis of a level also covers any remainder
+    // left by truncating odd extents, so the pyramid stays conservative.
+    const uint32_t max_extent = std::max(extent.width, std::max(extent.height, extent.depth));
+    uint32_t mip_levels = 1;
+    while (mip_levels < Scene::MAX_VOLUME_MIP_LEVELS && (max_extent >> mip_levels) > 0)
+	++mip_levels;
+
+    std::vector<VkExtent3D> mip_extents(mip_levels);
+    std::size_t pyramid_size = 0;
+    for (uint32_t level = 0; level < mip_levels; ++level) {
+	mip_extents[level] = {std::max(extent.width >> level, 1U), std::max(extent.height >> level, 1U), std::max(extent.depth >> level, 1U)};
+	pyramid_size += (std::size_t) mip_extents[level].width * mip_extents[level].height * mip_extents[level].depth;
+    }
+
+    // Reduce in host memory, since the staging buffer is write-combined.
+    std::vector<uint8_t> pyramid(pyramid_size);
+    const std::size_t volume_size = (std::size_t) extent.width * extent.height * extent.depth;
+    memcpy(pyramid.data(), voxel_model.voxels.data(), volume_size);
+
+    const uint8_t *prev_level = pyramid.data();
+    uint8_t *curr_level = pyramid.data() + volume_size;
+    for (uint32_t level = 1; level < mip_levels; ++level) {
+	const VkExtent3D prev = mip_extents[level - 1];
+	const VkExtent3D curr = mip_extents[level];
+	for (uint32_t z = 0; z < curr.depth; ++z) {
+	    const uint32_t z_end = z + 1 == curr.depth ? prev.depth : 2 * z + 2;
+	    for (uint32_t y = 0; y < curr.height; ++y) {
+		const uint32_t y_end = y + 1 == curr.height ? prev.height : 2 * y + 2;
+		for (uint32_t x = 0; x < curr.width; ++x) {
+		    const uint32_t x_end = x + 1 == curr.width ? prev.width : 2 * x + 2;
+		    uint8_t occupancy = 0;
+		    for (uint32_t pz = 2 * z; pz < z_end; ++pz)
+			for (uint32_t py = 2 * y; py < y_end; ++py)
+			    for (uint32_t px = 2 * x; px < x_end; ++px)
+				occupancy = std::max(occupancy, prev_level[px + prev.width * (py + prev.height * pz)]);
+		    curr_level[x + curr.width * (y + curr.height * z)] = occupancy;
+		}
+	    }
+	}
+	prev_level = curr_level;
+	curr_level += (std::size_t) curr.width * curr.height * curr.depth;
+    }
+
+    void *data_image = ringbuffer_claim_buffer(main_ring_buffer, pyramid_size);
+    memcpy(data_image, pyramid.data(), pyramid_size);
+
+    Volume dst = create_volume(0, format, extent, mip_levels, 1, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "VOLUME_IMAGE");
+    ringbuffer_submit_buffer(main_ring_buffer, dst, sizeof(uint8_t), VK_IMAGE_LAYOUT_GENERAL);
 
     VkImageSubresourceRange subresource_range {};
     subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     subresource_range.baseMipLevel = 0;
-    subresource_range.levelCount = 1;
+    subresource_range.levelCount = mip_levels;
     subresource_range.baseArrayLayer = 0;
     subresource_range.layerCount = 1;
 
     return {dst, create_image3d_view(dst.image, format, subresource_range)};
 }
 
+// Walks every parent node, following child and far pointers the same way
+// svo_rint.glsl does, and returns the depth of the deepest leaf.
+static auto svo_depth(const std::vector<uint32_t> &svo) noexcept -> uint32_t {
+    uint32_t max_depth = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> parents = {{0, 0}};
+    while (!parents.empty()) {
+	const auto [node, depth] = parents.back();
+	parents.pop_back();
+	ASSERT(depth < MAX_SVO_DEPTH, "SVO model is deeper than MAX_SVO_DEPTH.");
+
+	const uint32_t word = svo[node];
+	const uint32_t valid_mask = (word >> 16) & 0xFF;
+	const uint32_t leaf_mask = word >> 24;
+	uint32_t child_pointer = word & 0x7FFF;
+	if (word & 0x8000) {
+	    ASSERT(node + child_pointer < svo.size(), "SVO far pointer is out of bounds.");
+	    child_pointer = svo[node + child_pointer];
+	}
+	for (uint32_t k = 0, rank = 0; k < 8; ++k) {
+	    if (!(valid_mask & (1 << k)))
+		continue;
+	    const uint32_t child = node + child_pointer + rank++;
+	    ASSERT(child < svo.size(), "SVO child pointer is out of bounds.");
+	    if (leaf_mask & (1 << k))
+		max_depth = std::max(max_depth, depth + 1);
+	    else
+		parents.push_back({child, depth + 1});
+	}
+    }
+    return max_depth;
+}
+
+auto RenderContext::load_svo_model(std::string_view model_name, Scene &scene) noexcept -> uint16_t {
+    ZoneScoped;
+    const std::string svo_filepath =
+	std::string("models/") +
+	std::string(model_name) +
+	std::string(".svo");
+    auto it = scene.loaded_voxel_models.find(svo_filepath);
+    if (it != scene.loaded_voxel_models.end())
+	return it->second;
+
+    if (std::filesystem::exists(svo_filepath)) {
+	ASSERT(scene.num_voxel_models < Scene::MAX_SVO_MODELS, "Tried to load too many voxel models.");
+	const uint16_t voxel_model_id = scene.num_voxel_models;
+	std::vector<uint32_t> svo = load_dot_svo_model(svo_filepath);
+	const uint32_t depth = svo_depth(svo);
+	scene.voxel_svo_offsets.push_back((uint32_t) scene.svo_nodes.size());
+	scene.svo_nodes.insert(scene.svo_nodes.end(), svo.begin(), svo.end());
+
+	VoxelModel palette_only_model {};
+	palette_only_model.palette.fill(0xFFFFFFFF);
+	scene.voxel_models.emplace_back(std::move(palette_only_model));
+	scene.voxel_volumes.emplace_back();
+
+	++scene.num_voxel_models;
+	scene.voxel_transforms.emplace_back();
+	scene.voxel_blass.push_back(VK_NULL_HANDLE);
+	scene.voxel_blas_buffers.emplace_back();
+	scene.solid_or_volumetric.push_back(true);
+
+	scene.loaded_voxel_models.emplace(svo_filepath, voxel_model_id);
+
+	std::cout << "INFO: Loaded SVO model " << svo_filepath << " (" << svo.size() << " nodes, depth " << depth << ").\n";
+	return voxel_model_id;
+    } else {
+	ASSERT(false, "Couldn't find SVO model with given name. Currently, only .svo models produced by voxelize are supported.");
+	return {};
+    }
+}
+
+auto RenderContext::load_dot_svo_model(std::string_view svo_filepath) noexcept -> std::vector<uint32_t> {
+    ZoneScoped;
+    auto file_size = std::filesystem::file_size(svo_filepath);
+    ASSERT(file_size > 0 && file_size % sizeof(uint32_t) == 0, ".svo file isn't a whole number of nodes.");
+    std::vector<uint32_t> nodes(file_size / sizeof(uint32_t));
+    FILE *f = fopen(&svo_filepath[0], "r");
+    ASSERT(f, "Couldn't open .svo file.");
+    auto read_size = fread(nodes.data(), 1, file_size, f);
+    ASSERT(file_size == read_size, "Something went wrong reading .svo file.");
+    fclose(f);
+    return nodes;
+}
+
 auto RenderContext::load_volumetric_model(std::string_view model_name, Scene &scene) noexcept -> uint16_t {
     ZoneScoped;
     auto it = scene.loaded_voxel_models.find(std::string(model_name));
@@ -677,9 +817,10 @@ auto RenderContext::load_volumetric_model(std::string_view model_name, Scene &sc
 	
 	++scene.num_voxel_models;
 	scene.voxel_transforms.emplace_back();
+	scene.voxel_svo_offsets.push_back(Scene::NO_SVO);
 	scene.voxel_blass.push_back(VK_NULL_HANDLE);
 	scene.voxel_blas_buffers.emplace_back();
-	scene.solid_or_volumetric.emplace_back();
+	scene.solid_or_volumetric.push_back(false);
 
 	update_descriptors_volumes(scene, voxel_model_id);
 
@@ -700,223 +841,279 @@ auto glm4x4_to_vk_transform(const glm::mat4 &in, VkTransformMatrixKHR &out) noex
     }
 }
 
-auto RenderContext::build_bottom_level_acceleration_structure_for_model(uint16_t model_idx, Scene &scene) noexcept -> void {
+auto RenderContext::bottom_level_build_for_model(uint16_t model_idx, Scene &scene) noexcept -> BottomLevelBuild {
     ZoneScoped;
     const VkDeviceAddress vertex_buffer_address = get_device_address(scene.vertices_buf);
     const VkDeviceAddress index_buffer_address = get_device_address(scene.indices_buf);
-    const VkDeviceSize alignment = acceleration_structure_properties.minAccelerationStructureScratchOffsetAlignment;
 
     VkAccelerationStructureGeometryTrianglesDataKHR geometry_triangles_data {};
     geometry_triangles_data.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
     geometry_triangles_data.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
     geometry_triangles_data.vertexData.deviceAddress = vertex_buffer_address + scene.model_vertices_offsets[model_idx];
-    geometry_triangles_data.vertexStride = sizeof(Model::Vertex);
-    geometry_triangles_data.indexType = VK_INDEX_TYPE_UINT32;
+    geometry_triangles_data.vertexStride = sizeof(Model::PackedVertex);
+    geometry_triangles_data.indexType = scene.models[model_idx].narrow_indices() ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
     geometry_triangles_data.indexData.deviceAddress = index_buffer_address + scene.model_indices_offsets[model_idx];
     geometry_triangles_data.maxVertex = scene.models[model_idx].num_vertices();
     
-    VkAccelerationStructureGeometryKHR blas_geometry {};
-    blas_geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
-    blas_geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
-    blas_geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
-    blas_geometry.geometry.triangles = geometry_triangles_data;
-    
-    VkAccelerationStructureBuildRangeInfoKHR blas_build_range_info {};
-    blas_build_range_info.firstVertex = 0;
-    blas_build_range_info.primitiveCount = scene.models[model_idx].num_triangles();
-    blas_build_range_info.primitiveOffset = 0;
-    blas_build_range_info.transformOffset = 0;
-    VkAccelerationStructureBuildRangeInfoKHR *blas_build_range_infos[] = {&blas_build_range_info};
-    
-    VkAccelerationStructureBuildGeometryInfoKHR blas_build_geometry_info {};
-    blas_build_geometry_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
-    blas_build_geometry_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-    blas_build_geometry_info.flags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
-    blas_build_geometry_info.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
-    blas_build_geometry_info.geometryCount = 1;
-    blas_build_geometry_info.pGeometries = &blas_geometry;
-    
-    const uint32_t max_primitive_counts[] = {scene.models[model_idx].num_triangles()};
-    
-    VkAccelerationStructureBuildSizesInfoKHR blas_build_sizes_info {};
-    blas_build_sizes_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
-    vkGetAccelerationStructureBuildSizesKHR(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &blas_build_geometry_info, max_primitive_counts, &blas_build_sizes_info);
-    
-    Buffer blas_build_scratch_buffer = create_buffer_with_alignment(blas_build_sizes_info.buildScratchSize, alignment, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "SCENE_BLAS_BUILD_SCRATCH_BUFFER");
-    Buffer blas_acceleration_structure_buffer = create_buffer_with_alignment(blas_build_sizes_info.accelerationStructureSize, alignment, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "SCENE_BLAS_BUFFER");
-    
-    VkAccelerationStructureCreateInfoKHR bottom_level_create_info {};
-    bottom_level_create_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
-    bottom_level_create_info.buffer = blas_acceleration_structure_buffer.buffer;
-    bottom_level_create_info.offset = 0;
-    bottom_level_create_info.size = blas_build_sizes_info.accelerationStructureSize;
-    bottom_level_create_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-    
-    VkAccelerationStructureKHR bottom_level_acceleration_structure;
-    ASSERT(vkCreateAccelerationStructureKHR(device, &bottom_level_create_info, NULL, &bottom_level_acceleration_structure), "Unable to create bottom level acceleration structure.");
-    
-    blas_build_geometry_info.dstAccelerationStructure = bottom_level_acceleration_structure;
-    blas_build_geometry_info.scratchData.deviceAddress = get_device_address(blas_build_scratch_buffer);
-
-    inefficient_run_commands([&](VkCommandBuffer cmd) {
-	vkCmdBuildAccelerationStructuresKHR(cmd, 1, &blas_build_geometry_info, (const VkAccelerationStructureBuildRangeInfoKHR* const*) blas_build_range_infos);
-    });
-
-    cleanup_buffer(blas_build_scratch_buffer);
-    scene.blass[model_idx] = bottom_level_acceleration_structure;
-    scene.blas_buffers[model_idx] = blas_acceleration_structure_buffer;
+    BottomLevelBuild build {};
+    build.geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+    build.geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
+    build.geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+    build.geometry.geometry.triangles = geometry_triangles_data;
+    build.range.primitiveCount = scene.models[model_idx].num_triangles();
+    build.dst = &scene.blass[model_idx];
+    build.dst_buffer = &scene.blas_buffers[model_idx];
+    return build;
 }
 
-auto RenderContext::build_bottom_level_acceleration_structure_for_voxel_model(uint16_t voxel_model_idx, Scene &scene, bool solid) noexcept -> void {
+auto RenderContext::bottom_level_build_for_voxel_model(uint16_t voxel_model_idx, Scene &scene) noexcept -> BottomLevelBuild {
     ZoneScoped;
-    const VkDeviceSize alignment = acceleration_structure_properties.minAccelerationStructureScratchOffsetAlignment;
-
     VkAccelerationStructureGeometryAabbsDataKHR geometry_aabbs_data {};
     geometry_aabbs_data.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_AABBS_DATA_KHR;
     geometry_aabbs_data.data.deviceAddress = get_device_address(cube_buffer);
     geometry_aabbs_data.stride = sizeof(VkAabbPositionsKHR);
     
-    VkAccelerationStructureGeometryKHR blas_geometry {};
-    blas_geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
-    blas_geometry.geometryType = VK_GEOMETRY_TYPE_AABBS_KHR;
-    blas_geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
-    blas_geometry.geometry.aabbs = geometry_aabbs_data;
-    
-    VkAccelerationStructureBuildRangeInfoKHR blas_build_range_info {};
-    blas_build_range_info.firstVertex = 0;
-    blas_build_range_info.primitiveCount = 1;
-    blas_build_range_info.primitiveOffset = 0;
-    blas_build_range_info.transformOffset = 0;
-    VkAccelerationStructureBuildRangeInfoKHR *blas_build_range_infos[] = {&blas_build_range_info};
-    
-    VkAccelerationStructureBuildGeometryInfoKHR blas_build_geometry_info {};
-    blas_build_geometry_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
-    blas_build_geometry_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-    blas_build_geometry_info.flags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
-    blas_build_geometry_info.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
-    blas_build_geometry_info.geometryCount = 1;
-    blas_build_geometry_info.pGeometries = &blas_geometry;
-    
-    const uint32_t max_primitive_counts[] = {1};
-    
-    VkAccelerationStructureBuildSizesInfoKHR blas_build_sizes_info {};
-    blas_build_sizes_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
-    vkGetAccelerationStructureBuildSizesKHR(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &blas_build_geometry_info, max_primitive_counts, &blas_build_sizes_info);
-    
-    Buffer blas_build_scratch_buffer = create_buffer_with_alignment(blas_build_sizes_info.buildScratchSize, alignment, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "SCENE_BLAS_BUILD_SCRATCH_BUFFER");
-    Buffer blas_acceleration_structure_buffer = create_buffer_with_alignment(blas_build_sizes_info.accelerationStructureSize, alignment, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "SCENE_BLAS_BUFFER");
-    
-    VkAccelerationStructureCreateInfoKHR bottom_level_create_info {};
-    bottom_level_create_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
-    bottom_level_create_info.buffer = blas_acceleration_structure_buffer.buffer;
-    bottom_level_create_info.offset = 0;
-    bottom_level_create_info.size = blas_build_sizes_info.accelerationStructureSize;
-    bottom_level_create_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-    
-    VkAccelerationStructureKHR bottom_level_acceleration_structure;
-    ASSERT(vkCreateAccelerationStructureKHR(device, &bottom_level_create_info, NULL, &bottom_level_acceleration_structure), "Unable to create bottom level acceleration structure.");
-    
-    blas_build_geometry_info.dstAccelerationStructure = bottom_level_acceleration_structure;
-    blas_build_geometry_info.scratchData.deviceAddress = get_device_address(blas_build_scratch_buffer);
-
-    inefficient_run_commands([&](VkCommandBuffer cmd) {
-	vkCmdBuildAccelerationStructuresKHR(cmd, 1, &blas_build_geometry_info, (const VkAccelerationStructureBuildRangeInfoKHR* const*) blas_build_range_infos);
-    });
-
-    cleanup_buffer(blas_build_scratch_buffer);
-    scene.voxel_blass[voxel_model_idx] = bottom_level_acceleration_structure;
-    scene.voxel_blas_buffers[voxel_model_idx] = blas_acceleration_structure_buffer;
-    scene.solid_or_volumetric[voxel_model_idx] = solid;
+    BottomLevelBuild build {};
+    build.geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+    build.geometry.geometryType = VK_GEOMETRY_TYPE_AABBS_KHR;
+    build.geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+    build.geometry.geometry.aabbs = geometry_aabbs_data;
+    build.range.primitiveCount = 1;
+    build.dst = &scene.voxel_blass[voxel_model_idx];
+    build.dst_buffer = &scene.voxel_blas_buffers[voxel_model_idx];
+    return build;
 }
 
-
-auto RenderContext::build_bottom_level_acceleration_structure_for_lights(Scene &scene) noexcept -> void {
+auto RenderContext::bottom_level_build_for_lights(Scene &scene) noexcept -> BottomLevelBuild {
     ZoneScoped;
-    const VkDeviceSize alignment = acceleration_structure_properties.minAccelerationStructureScratchOffsetAlignment;
-
     VkAccelerationStructureGeometryAabbsDataKHR geometry_aabbs_data {};
     geometry_aabbs_data.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_AABBS_DATA_KHR;
     geometry_aabbs_data.data.deviceAddress = get_device_address(scene.light_aabbs_buf);
     geometry_aabbs_data.stride = sizeof(VkAabbPositionsKHR);
     
-    VkAccelerationStructureGeometryKHR blas_geometry {};
-    blas_geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
-    blas_geometry.geometryType = VK_GEOMETRY_TYPE_AABBS_KHR;
-    blas_geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
-    blas_geometry.geometry.aabbs = geometry_aabbs_data;
-    
-    VkAccelerationStructureBuildRangeInfoKHR blas_build_range_info {};
-    blas_build_range_info.firstVertex = 0;
-    blas_build_range_info.primitiveCount = scene.num_lights;
-    blas_build_range_info.primitiveOffset = 0;
-    blas_build_range_info.transformOffset = 0;
-    VkAccelerationStructureBuildRangeInfoKHR *blas_build_range_infos[] = {&blas_build_range_info};
-    
-    VkAccelerationStructureBuildGeometryInfoKHR blas_build_geometry_info {};
-    blas_build_geometry_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
-    blas_build_geometry_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-    blas_build_geometry_info.flags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
-    blas_build_geometry_info.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
-    blas_build_geometry_info.geometryCount = 1;
-    blas_build_geometry_info.pGeometries = &blas_geometry;
-    
-    const uint32_t max_primitive_counts[] = {scene.num_lights};
-    
-    VkAccelerationStructureBuildSizesInfoKHR blas_build_sizes_info {};
-    blas_build_sizes_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
-    vkGetAccelerationStructureBuildSizesKHR(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &blas_build_geometry_info, max_primitive_counts, &blas_build_sizes_info);
-    
-    Buffer blas_build_scratch_buffer = create_buffer_with_alignment(blas_build_sizes_info.buildScratchSize, alignment, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "SCENE_BLAS_BUILD_SCRATCH_BUFFER");
-    Buffer blas_acceleration_structure_buffer = create_buffer_with_alignment(blas_build_sizes_info.accelerationStructureSize, alignment, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "SCENE_BLAS_BUFFER");
-    
-    VkAccelerationStructureCreateInfoKHR bottom_level_create_info {};
-    bottom_level_create_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
-    bottom_level_create_info.buffer = blas_acceleration_structure_buffer.buffer;
-    bottom_level_create_info.offset = 0;
-    bottom_level_create_info.size = blas_build_sizes_info.accelerationStructureSize;
-    bottom_level_create_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-    
-    VkAccelerationStructureKHR bottom_level_acceleration_structure;
-    ASSERT(vkCreateAccelerationStructureKHR(device, &bottom_level_create_info, NULL, &bottom_level_acceleration_structure), "Unable to create bottom level acceleration structure.");
-    
-    blas_build_geometry_info.dstAccelerationStructure = bottom_level_acceleration_structure;
-    blas_build_geometry_info.scratchData.deviceAddress = get_device_address(blas_build_scratch_buffer);
-
-    inefficient_run_commands([&](VkCommandBuffer cmd) {
-	vkCmdBuildAccelerationStructuresKHR(cmd, 1, &blas_build_geometry_info, (const VkAccelerationStructureBuildRangeInfoKHR* const*) blas_build_range_infos);
-    });
+    BottomLevelBuild build {};
+    build.geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+    build.geometry.geometryType = VK_GEOMETRY_TYPE_AABBS_KHR;
+    build.geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+    build.geometry.geometry.aabbs = geometry_aabbs_data;
+    build.range.primitiveCount = scene.num_lights;
+    build.dst = &scene.lights_blas;
+    build.dst_buffer = &scene.lights_blas_buffer;
+    return build;
+}
 
-    cleanup_buffer(blas_build_scratch_buffer);
-    scene.lights_blas = bottom_level_acceleration_structure;
-    scene.lights_blas_buffer = blas_acceleration_structure_buffer;
+auto RenderContext::build_bottom_level_acceleration_structures(std::span<const uint16_t> model_idxs, std::span<const uint16_t> voxel_model_idxs, Scene &scene) noexcept -> void {
+    ZoneScoped;
+    std::vector<BottomLevelBuild> builds;
+    std::vector<bool> mesh_queued(scene.num_models, false);
+    for (uint16_t model_idx : model_idxs) {
+	const uint16_t mesh_id = scene.model_mesh_ids[model_idx];
+	if (!mesh_queued[mesh_id]) {
+	    mesh_queued[mesh_id] = true;
+	    builds.push_back(bottom_level_build_for_model(mesh_id, scene));
+	}
+    }
+    for (uint16_t voxel_model_idx : voxel_model_idxs)
+	builds.push_back(bottom_level_build_for_voxel_model(voxel_model_idx, scene));
+    builds.push_back(bottom_level_build_for_lights(scene));
+    build_bottom_level_acceleration_structures(builds);
 }
 
-auto RenderContext::build_top_level_acceleration_structure_for_scene(Scene &scene) noexcept -> void {
+auto RenderContext::build_bottom_level_acceleration_structures(std::span<BottomLevelBuild> builds) noexcept -> void {
     ZoneScoped;
     const VkDeviceSize alignment = acceleration_structure_properties.minAccelerationStructureScratchOffsetAlignment;
 
-    std::vector<VkAccelerationStructureInstanceKHR> bottom_level_instances;
+    // Every build gets its own aligned slice of one shared scratch arena, so all of
+    // them can be recorded into a single vkCmdBuildAccelerationStructuresKHR call.
+    std::vector<VkAccelerationStructureBuildGeometryInfoKHR> build_geometry_infos(builds.size());
+    std::vector<const VkAccelerationStructureBuildRangeInfoKHR *> build_range_infos(builds.size());
+    std::vector<VkDeviceSize> scratch_offsets(builds.size());
+    VkDeviceSize scratch_size = 0;
+    for (std::size_t i = 0; i < builds.size(); ++i) {
+	VkAccelerationStructureBuildGeometryInfoKHR &blas_build_geometry_info = build_geometry_infos[i];
+	blas_build_geometry_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+	blas_build_geometry_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+	blas_build_geometry_info.flags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+	blas_build_geometry_info.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+	blas_build_geometry_info.geometryCount = 1;
+	blas_build_geometry_info.pGeometries = &builds[i].geometry;
+	build_range_infos[i] = &builds[i].range;
+
+	const uint32_t max_primitive_counts[] = {builds[i].range.primitiveCount};
+	VkAccelerationStructureBuildSizesInfoKHR blas_build_sizes_info {};
+	blas_build_sizes_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+	vkGetAccelerationStructureBuildSizesKHR(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &blas_build_geometry_info, max_primitive_counts, &blas_build_sizes_info);
+
+	Buffer blas_acceleration_structure_buffer = create_buffer_with_alignment(blas_build_sizes_info.accelerationStructureSize, alignment, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "SCENE_BLAS_BUFFER");
+
+	VkAccelerationStructureCreateInfoKHR bottom_level_create_info {};
+	bottom_level_create_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+	bottom_level_create_info.buffer = blas_acceleration_structure_buffer.buffer;
+	bottom_level_create_info.offset = 0;
+	bottom_level_create_info.size = blas_build_sizes_info.accelerationStructureSize;
+	bottom_level_create_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+    
+	VkAccelerationStructureKHR bottom_level_acceleration_structure;
+	ASSERT(vkCreateAccelerationStructureKHR(device, &bottom_level_create_info, NULL, &bottom_level_acceleration_structure), "Unable to create bottom level acceleration structure.");
+	blas_build_geometry_info.dstAccelerationStructure = bottom_level_acceleration_structure;
+	*builds[i].dst = bottom_level_acceleration_structure;
+	*builds[i].dst_buffer = blas_acceleration_structure_buffer;
+
+	scratch_offsets[i] = scratch_size;
+	scratch_size += (blas_build_sizes_info.buildScratchSize + alignment - 1) & ~(alignment - 1);
+    }
+
+    Buffer blas_build_scratch_buffer = create_buffer_with_alignment(scratch_size, alignment, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "SCENE_BLAS_BUILD_SCRATCH_BUFFER");
+    const VkDeviceAddress scratch_address = get_device_address(blas_build_scratch_buffer);
+    for (std::size_t i = 0; i < builds.size(); ++i)
+	build_geometry_infos[i].scratchData.deviceAddress = scratch_address + scratch_offsets[i];
+
+    VkCommandBufferAllocateInfo allocate_info {};
+    allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocate_info.commandPool = command_pool;
+    allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocate_info.commandBufferCount = 1;
+
+    VkCommandBuffer command_buffer;
+    ASSERT(vkAllocateCommandBuffers(device, &allocate_info, &command_buffer), "Unable to create command buffers.");
+
+    VkCommandBufferBeginInfo begin_info {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    ASSERT(vkBeginCommandBuffer(command_buffer, &begin_info), "Unable to begin recording bottom level build command buffer.");
+
+    VkMemoryBarrier memory_barrier {};
+    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memory_barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &memory_barrier, 0, NULL, 0, NULL);
+    vkCmdBuildAccelerationStructuresKHR(command_buffer, (uint32_t) build_geometry_infos.size(), build_geometry_infos.data(), build_range_infos.data());
+
+    // Every BLAS is built with ALLOW_COMPACTION, so query how small each one can
+    // get in the same submission.
+    VkQueryPoolCreateInfo query_pool_create_info {};
+    query_pool_create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    query_pool_create_info.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR;
+    query_pool_create_info.queryCount = (uint32_t) builds.size();
+
+    VkQueryPool query_pool;
+    ASSERT(vkCreateQueryPool(device, &query_pool_create_info, NULL, &query_pool), "Unable to create query pool.");
+
+    std::vector<VkAccelerationStructureKHR> built_acceleration_structures(builds.size());
+    for (std::size_t i = 0; i < builds.size(); ++i)
+	built_acceleration_structures[i] = *builds[i].dst;
+
+    memory_barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    memory_barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &memory_barrier, 0, NULL, 0, NULL);
+    vkCmdResetQueryPool(command_buffer, query_pool, 0, (uint32_t) builds.size());
+    vkCmdWriteAccelerationStructuresPropertiesKHR(command_buffer, (uint32_t) built_acceleration_structures.size(), built_acceleration_structures.data(), VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, query_pool, 0);
+    ASSERT(vkEndCommandBuffer(command_buffer), "Something went wrong recording into bottom level build command buffer.");
+
+    VkFence build_fence = create_fence();
+    vkResetFences(device, 1, &build_fence);
+
+    // Builds read vertices and indices the ring may still be uploading.
+    ringbuffer_flush(main_ring_buffer);
+    VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR;
+    VkTimelineSemaphoreSubmitInfo timeline_submit_info {};
+    timeline_submit_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timeline_submit_info.waitSemaphoreValueCount = 1;
+    timeline_submit_info.pWaitSemaphoreValues = &main_ring_buffer.submitted_value;
+
+    VkSubmitInfo submit_info {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = &timeline_submit_info;
+    submit_info.waitSemaphoreCount = 1;
+    submit_info.pWaitSemaphores = &main_ring_buffer.timeline;
+    submit_info.pWaitDstStageMask = &wait_stage;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &command_buffer;
+    ASSERT(vkQueueSubmit(queue, 1, &submit_info, build_fence), "Unable to submit bottom level builds.");
+    ASSERT(vkWaitForFences(device, 1, &build_fence, VK_TRUE, UINT64_MAX), "Unable to wait for bottom level builds.");
+    cleanup_buffer(blas_build_scratch_buffer);
+
+    std::vector<VkDeviceSize> compacted_sizes(builds.size());
+    ASSERT(vkGetQueryPoolResults(device, query_pool, 0, (uint32_t) builds.size(), compacted_sizes.size() * sizeof(VkDeviceSize), compacted_sizes.data(), sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT), "Unable to get compacted acceleration structure sizes.");
+    vkDestroyQueryPool(device, query_pool, NULL);
+
+    // Copy each BLAS into a right-sized buffer, then free the original.
+    std::vector<Buffer> original_buffers(builds.size());
+    ASSERT(vkBeginCommandBuffer(command_buffer, &begin_info), "Unable to begin recording bottom level compaction command buffer.");
+    for (std::size_t i = 0; i < builds.size(); ++i) {
+	original_buffers[i] = *builds[i].dst_buffer;
+	Buffer compacted_buffer = create_buffer_with_alignment(compacted_sizes[i], alignment, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "SCENE_COMPACTED_BLAS_BUFFER");
+
+	VkAccelerationStructureCreateInfoKHR compacted_create_info {};
+	compacted_create_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+	compacted_create_info.buffer = compacted_buffer.buffer;
+	compacted_create_info.offset = 0;
+	compacted_create_info.size = compacted_sizes[i];
+	compacted_create_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+
+	VkAccelerationStructureKHR compacted_acceleration_structure;
+	ASSERT(vkCreateAccelerationStructureKHR(device, &compacted_create_info, NULL, &compacted_acceleration_structure), "Unable to create compacted bottom level acceleration structure.");
+
+	VkCopyAccelerationStructureInfoKHR copy_info {};
+	copy_info.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR;
+	copy_info.src = built_acceleration_structures[i];
+	copy_info.dst = compacted_acceleration_structure;
+	copy_info.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
+	vkCmdCopyAccelerationStructureKHR(command_buffer, &copy_info);
+
+	imgui_data.blas_bytes_before_compaction += original_buffers[i].size;
+	imgui_data.blas_bytes_after_compaction += compacted_sizes[i];
+	*builds[i].dst = compacted_acceleration_structure;
+	*builds[i].dst_buffer = compacted_buffer;
+    }
+    ASSERT(vkEndCommandBuffer(command_buffer), "Something went wrong recording into bottom level compaction command buffer.");
+
+    vkResetFences(device, 1, &build_fence);
+    ASSERT(vkQueueSubmit(queue, 1, &submit_info, build_fence), "Unable to submit bottom level compaction.");
+    ASSERT(vkWaitForFences(device, 1, &build_fence, VK_TRUE, UINT64_MAX), "Unable to wait for bottom level compaction.");
+
+    for (std::size_t i = 0; i < builds.size(); ++i) {
+	vkDestroyAccelerationStructureKHR(device, built_acceleration_structures[i], NULL);
+	cleanup_buffer(original_buffers[i]);
+    }
+    vkDestroyFence(device, build_fence, NULL);
+    vkFreeCommandBuffers(device, command_pool, 1, &command_buffer);
+    std::cout << "INFO: Built " << builds.size() << " bottom level acceleration structures in one batch (compacted " << imgui_data.blas_bytes_before_compaction << " bytes to " << imgui_data.blas_bytes_after_compaction << " bytes so far).\n";
+}
+
+auto RenderContext::count_top_level_instances(const Scene &scene) noexcept -> uint32_t {
+    return scene.num_objects + scene.num_voxel_objects + 1;
+}
+
+auto RenderContext::write_top_level_instances(const Scene &scene, VkAccelerationStructureInstanceKHR *dst) noexcept -> void {
+    ZoneScoped;
     VkAccelerationStructureInstanceKHR bottom_level_instance {};
     bottom_level_instance.instanceCustomIndex = 0;
     for (uint16_t model_idx = 0; model_idx < scene.num_models; ++model_idx) {
+	const VkDeviceAddress blas_address = get_device_address(scene.blass[scene.model_mesh_ids[model_idx]]);
 	for (uint32_t transform_idx = 0; transform_idx < (uint32_t) scene.transforms[model_idx].size(); ++transform_idx) {
 	    glm4x4_to_vk_transform(scene.transforms[model_idx][transform_idx], bottom_level_instance.transform);
 	    bottom_level_instance.mask = 0xFF;
 	    bottom_level_instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
 	    bottom_level_instance.instanceShaderBindingTableRecordOffset = 0;
-	    bottom_level_instance.accelerationStructureReference = get_device_address(scene.blass[model_idx]);
-	    bottom_level_instances.push_back(bottom_level_instance);
+	    bottom_level_instance.accelerationStructureReference = blas_address;
+	    *(dst++) = bottom_level_instance;
 	    ++bottom_level_instance.instanceCustomIndex;
 	}
     }
     bottom_level_instance.instanceCustomIndex = 0;
     for (uint16_t voxel_model_idx = 0; voxel_model_idx < scene.num_voxel_models; ++voxel_model_idx) {
+	const VkDeviceAddress blas_address = get_device_address(scene.voxel_blass[voxel_model_idx]);
 	for (uint32_t transform_idx = 0; transform_idx < (uint32_t) scene.voxel_transforms[voxel_model_idx].size(); ++transform_idx) {
 	    glm4x4_to_vk_transform(scene.voxel_transforms[voxel_model_idx][transform_idx], bottom_level_instance.transform);
 	    bottom_level_instance.mask = 0xFF;
-	    bottom_level_instance.instanceShaderBindingTableRecordOffset = scene.solid_or_volumetric[voxel_model_idx] ? 1 : 3;
-	    bottom_level_instance.accelerationStructureReference = get_device_address(scene.voxel_blass[voxel_model_idx]);
-	    bottom_level_instances.push_back(bottom_level_instance);
+	    if (scene.voxel_svo_offsets[voxel_model_idx] != Scene::NO_SVO) {
+		bottom_level_instance.instanceShaderBindingTableRecordOffset = 4;
+	    } else {
+		bottom_level_instance.instanceShaderBindingTableRecordOffset = scene.solid_or_volumetric[voxel_model_idx] ? 1 : 3;
+	    }
+	    bottom_level_instance.accelerationStructureReference = blas_address;
+	    *(dst++) = bottom_level_instance;
 	    ++bottom_level_instance.instanceCustomIndex;
 	}
     }
@@ -925,23 +1122,41 @@ auto RenderContext::build_top_level_acceleration_structure_for_scene(Scene &scen
     bottom_level_instance.mask = 0xFF;
     bottom_level_instance.instanceShaderBindingTableRecordOffset = 2;
     bottom_level_instance.accelerationStructureReference = get_device_address(scene.lights_blas);
-    bottom_level_instances.push_back(bottom_level_instance);
-    
-    Buffer instances_buffer = create_buffer(bottom_level_instances.size() * sizeof(VkAccelerationStructureInstanceKHR), VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_HEAP_DEVICE_LOCAL_BIT, 0, "SCENE_TLAS_INSTANCES_BUFFER");
-    inefficient_upload_to_buffer((void *) bottom_level_instances.data(), bottom_level_instances.size() * sizeof(VkAccelerationStructureInstanceKHR), instances_buffer);
-    
+    *(dst++) = bottom_level_instance;
+}
+
+auto RenderContext::top_level_build_geometry(const Scene &scene, uint32_t instances_slot) noexcept -> VkAccelerationStructureGeometryKHR {
     VkAccelerationStructureGeometryInstancesDataKHR geometry_instances_data {};
     geometry_instances_data.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
-    geometry_instances_data.data.deviceAddress = get_device_address(instances_buffer);
+    geometry_instances_data.data.deviceAddress = get_device_address(scene.tlas_instances_buffer) + (VkDeviceAddress) instances_slot * scene.tlas_num_instances * sizeof(VkAccelerationStructureInstanceKHR);
 
     VkAccelerationStructureGeometryKHR tlas_geometry {};
     tlas_geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
     tlas_geometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
     tlas_geometry.geometry.instances = geometry_instances_data;
+    return tlas_geometry;
+}
+
+auto RenderContext::build_top_level_acceleration_structure_for_scene(Scene &scene) noexcept -> void {
+    ZoneScoped;
+    const VkDeviceSize alignment = acceleration_structure_properties.minAccelerationStructureScratchOffsetAlignment;
+
+    // The instance buffer stays mapped for the lifetime of the TLAS, so per-frame
+    // refits can write transforms straight into it. Each frame in flight gets
+    // its own slot, so a refit never overwrites instances a running build reads.
+    const uint32_t num_instances = count_top_level_instances(scene);
+    scene.tlas_num_instances = num_instances;
+    scene.tlas_instances_buffer = create_buffer(FRAMES_IN_FLIGHT * num_instances * sizeof(VkAccelerationStructureInstanceKHR), VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, "SCENE_TLAS_INSTANCES_BUFFER");
+    vmaMapMemory(allocator, scene.tlas_instances_buffer.allocation, (void **) &scene.tlas_instances_mapped);
+    scene.tlas_instances.resize(num_instances);
+    write_top_level_instances(scene, scene.tlas_instances.data());
+    memcpy(scene.tlas_instances_mapped, scene.tlas_instances.data(), num_instances * sizeof(VkAccelerationStructureInstanceKHR));
+    
+    VkAccelerationStructureGeometryKHR tlas_geometry = top_level_build_geometry(scene, 0);
     
     VkAccelerationStructureBuildRangeInfoKHR tlas_build_range_info {};
     tlas_build_range_info.firstVertex = 0;
-    tlas_build_range_info.primitiveCount = scene.num_objects + scene.num_voxel_objects + 1;
+    tlas_build_range_info.primitiveCount = num_instances;
     tlas_build_range_info.primitiveOffset = 0;
     tlas_build_range_info.transformOffset = 0;
     VkAccelerationStructureBuildRangeInfoKHR *tlas_build_range_infos[] = {&tlas_build_range_info}; 
@@ -949,18 +1164,19 @@ auto RenderContext::build_top_level_acceleration_structure_for_scene(Scene &scen
     VkAccelerationStructureBuildGeometryInfoKHR tlas_build_geometry_info {};
     tlas_build_geometry_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
     tlas_build_geometry_info.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
-    tlas_build_geometry_info.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+    tlas_build_geometry_info.flags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
     tlas_build_geometry_info.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
     tlas_build_geometry_info.geometryCount = 1;
     tlas_build_geometry_info.pGeometries = &tlas_geometry;
     
-    const uint32_t max_instances_counts[] = {scene.num_objects + scene.num_voxel_objects + 1};
+    const uint32_t max_instances_counts[] = {num_instances};
     
     VkAccelerationStructureBuildSizesInfoKHR tlas_build_sizes_info {};
     tlas_build_sizes_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
     vkGetAccelerationStructureBuildSizesKHR(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &tlas_build_geometry_info, max_instances_counts, &tlas_build_sizes_info);
     
-    Buffer tlas_build_scratch_buffer = create_buffer_with_alignment(tlas_build_sizes_info.buildScratchSize, alignment, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "SCENE_TLAS_BUILD_SCRATCH_BUFFER");
+    const VkDeviceSize scratch_size = std::max(tlas_build_sizes_info.buildScratchSize, tlas_build_sizes_info.updateScratchSize);
+    scene.tlas_scratch_buffer = create_buffer_with_alignment(scratch_size, alignment, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "SCENE_TLAS_BUILD_SCRATCH_BUFFER");
     Buffer tlas_acceleration_structure_buffer = create_buffer_with_alignment(tlas_build_sizes_info.accelerationStructureSize, alignment, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, "SCENE_TLAS_BUFFER");
     
     VkAccelerationStructureCreateInfoKHR top_level_create_info {};
@@ -974,7 +1190,7 @@ auto RenderContext::build_top_level_acceleration_structure_for_scene(Scene &scen
     ASSERT(vkCreateAccelerationStructureKHR(device, &top_level_create_info, NULL, &top_level_acceleration_structure), "Unable to create top level acceleration structure.");
 
     tlas_build_geometry_info.dstAccelerationStructure = top_level_acceleration_structure;
-    tlas_build_geometry_info.scratchData.deviceAddress = get_device_address(tlas_build_scratch_buffer);
+    tlas_build_geometry_info.scratchData.deviceAddress = get_device_address(scene.tlas_scratch_buffer);
 
     inefficient_run_commands([&](VkCommandBuffer cmd) {
 	vkCmdBuildAccelerationStructuresKHR(cmd, 1, &tlas_build_geometry_info, (const VkAccelerationStructureBuildRangeInfoKHR* const*) tlas_build_range_infos);
@@ -982,6 +1198,75 @@ auto RenderContext::build_top_level_acceleration_structure_for_scene(Scene &scen
 
     scene.tlas = top_level_acceleration_structure;
     scene.tlas_buffer = tlas_acceleration_structure_buffer;
-    scene.tlas_instances_buffer = instances_buffer;
-    cleanup_buffer(tlas_build_scratch_buffer);
+}
+
+auto RenderContext::cleanup_top_level_acceleration_structure_for_scene(Scene &scene) noexcept -> void {
+    ZoneScoped;
+    vkDestroyAccelerationStructureKHR(device, scene.tlas, NULL);
+    cleanup_buffer(scene.tlas_buffer);
+    vmaUnmapMemory(allocator, scene.tlas_instances_buffer.allocation);
+    cleanup_buffer(scene.tlas_instances_buffer);
+    cleanup_buffer(scene.tlas_scratch_buffer);
+}
+
+auto RenderContext::update_top_level_acceleration_structure_for_scene(Scene &scene) noexcept -> void {
+    ZoneScoped;
+    if (count_top_level_instances(scene) != scene.tlas_num_instances) {
+	vkQueueWaitIdle(queue);
+	cleanup_top_level_acceleration_structure_for_scene(scene);
+	build_top_level_acceleration_structure_for_scene(scene);
+	update_descriptors_tlas(scene);
+	cleanup_cached_passes();
+	tlas_refit_scene = NULL;
+	return;
+    }
+
+    // Only refit when some instance actually changed since the last build or
+    // refit, so a static scene records no TLAS work at all.
+    tlas_instances_scratchpad.resize(scene.tlas_num_instances);
+    write_top_level_instances(scene, tlas_instances_scratchpad.data());
+    if (memcmp(tlas_instances_scratchpad.data(), scene.tlas_instances.data(), scene.tlas_num_instances * sizeof(VkAccelerationStructureInstanceKHR))) {
+	std::swap(tlas_instances_scratchpad, scene.tlas_instances);
+	tlas_refit_scene = &scene;
+    }
+}
+
+auto RenderContext::record_top_level_refit(VkCommandBuffer command_buffer) noexcept -> void {
+    ZoneScoped;
+    if (!tlas_refit_scene)
+	return;
+    Scene &scene = *tlas_refit_scene;
+    tlas_refit_scene = NULL;
+
+    // Called after this slot's in-flight fence, so the refit that last used the
+    // slot is done reading it.
+    const uint32_t instances_slot = current_frame % FRAMES_IN_FLIGHT;
+    memcpy(scene.tlas_instances_mapped + (std::size_t) instances_slot * scene.tlas_num_instances, scene.tlas_instances.data(), scene.tlas_num_instances * sizeof(VkAccelerationStructureInstanceKHR));
+
+    VkAccelerationStructureGeometryKHR tlas_geometry = top_level_build_geometry(scene, instances_slot);
+
+    VkAccelerationStructureBuildRangeInfoKHR tlas_build_range_info {};
+    tlas_build_range_info.primitiveCount = scene.tlas_num_instances;
+    VkAccelerationStructureBuildRangeInfoKHR *tlas_build_range_infos[] = {&tlas_build_range_info};
+
+    VkAccelerationStructureBuildGeometryInfoKHR tlas_build_geometry_info {};
+    tlas_build_geometry_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+    tlas_build_geometry_info.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+    tlas_build_geometry_info.flags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+    tlas_build_geometry_info.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+    tlas_build_geometry_info.srcAccelerationStructure = scene.tlas;
+    tlas_build_geometry_info.dstAccelerationStructure = scene.tlas;
+    tlas_build_geometry_info.geometryCount = 1;
+    tlas_build_geometry_info.pGeometries = &tlas_geometry;
+    tlas_build_geometry_info.scratchData.deviceAddress = get_device_address(scene.tlas_scratch_buffer);
+
+    VkMemoryBarrier memory_barrier {};
+    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory_barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
+    memory_barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_HOST_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &memory_barrier, 0, NULL, 0, NULL);
+    vkCmdBuildAccelerationStructuresKHR(command_buffer, 1, &tlas_build_geometry_info, (const VkAccelerationStructureBuildRangeInfoKHR* const*) tlas_build_range_infos);
+    memory_barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    memory_barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memory_barrier, 0, NULL, 0, NULL);
 }
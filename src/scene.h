@@ -23,22 +23,36 @@
 #include "model.h"
 #include "util.h"
 
+// Deepest SVO svo_rint.glsl can traverse. The Makefile passes the same value
+// to the shader compiler.
+#ifndef MAX_SVO_DEPTH
+#error "MAX_SVO_DEPTH must be defined."
+#endif
+
 struct Scene {
     static const uint32_t MAX_LIGHTS = 512;
+    static const uint32_t MAX_SVO_MODELS = 256;
+    static const uint32_t MAX_VOLUME_MIP_LEVELS = 6;
+    static const uint32_t NO_SVO = 0xFFFFFFFF;
 
     struct RayTraceObject {
 	uint64_t vertex_address;
 	uint64_t index_address;
-	uint64_t model_id;
+	uint32_t model_id;
+	uint32_t narrow_indices;
+	uint32_t texture_ids[3];
     };
     
     std::vector<Model> models;
     std::vector<std::vector<glm::mat4>> transforms;
+    std::vector<uint16_t> model_mesh_ids;
     std::vector<std::pair<Image, VkImageView>> textures;
     std::vector<glm::vec4> lights;
     std::vector<VoxelModel> voxel_models;
     std::vector<std::pair<Volume, VkImageView>> voxel_volumes;
     std::vector<std::vector<glm::mat4>> voxel_transforms;
+    std::vector<uint32_t> voxel_svo_offsets;
+    std::vector<uint32_t> svo_nodes;
     uint16_t num_models;
     uint32_t num_objects;
     uint16_t num_textures;
@@ -46,25 +60,33 @@ struct Scene {
     uint16_t num_voxel_models;
     uint32_t num_voxel_objects;
 
-    Buffer vertices_buf, indices_buf, instances_buf, indirect_draw_buf, lights_buf, ray_trace_objects_buf, voxel_palette_buf, light_aabbs_buf;
-    std::size_t vertices_buf_contents_size, indices_buf_contents_size, instances_buf_contents_size, indirect_draw_buf_contents_size, lights_buf_contents_size, ray_trace_objects_buf_contents_size, voxel_palette_buf_contents_size, light_aabbs_buf_contents_size;
+    Buffer vertices_buf, indices_buf, instances_buf, indirect_draw_buf, lights_buf, ray_trace_objects_buf, voxel_palette_buf, light_aabbs_buf, svo_buf;
+    std::size_t vertices_buf_contents_size, indices_buf_contents_size, instances_buf_contents_size, indirect_draw_buf_contents_size, lights_buf_contents_size, ray_trace_objects_buf_contents_size, voxel_palette_buf_contents_size, light_aabbs_buf_contents_size, svo_buf_contents_size;
     std::vector<std::size_t> model_vertices_offsets, model_indices_offsets;
     std::map<std::string, uint16_t> loaded_models;
+    std::map<std::string, uint16_t> loaded_meshes;
     std::map<std::string, uint16_t> loaded_voxel_models;
+    // Keyed on a texture's source: its file, the files packed into it, or its
+    // solid color, so models with the same texture share one image and slot.
+    std::map<std::string, uint16_t> loaded_textures;
 
     VkAccelerationStructureKHR tlas;
     std::vector<VkAccelerationStructureKHR> blass;
     std::vector<VkAccelerationStructureKHR> voxel_blass;
     std::vector<bool> solid_or_volumetric;
     VkAccelerationStructureKHR lights_blas;
-    Buffer tlas_buffer, tlas_instances_buffer;
+    Buffer tlas_buffer, tlas_instances_buffer, tlas_scratch_buffer;
+    VkAccelerationStructureInstanceKHR *tlas_instances_mapped;
+    uint32_t tlas_num_instances;
+    // The instances the TLAS was last built or refit with.
+    std::vector<VkAccelerationStructureInstanceKHR> tlas_instances;
     std::vector<Buffer> blas_buffers;
     std::vector<Buffer> voxel_blas_buffers;
     Buffer lights_blas_buffer;
 
     auto add_object(const glm::mat4 &&transform, uint16_t model_id) noexcept -> void {
 	transforms[model_id].emplace_back(transform);
-	uint32_t model_info = models[model_id].base_texture_id;
+	uint32_t model_info = models[model_id].texture_ids[0];
 	transforms[model_id].back()[3][3] = std::bit_cast<float>(model_info);
 	++num_objects;
     }
@@ -85,7 +107,7 @@ struct Scene {
     static auto binding_descriptions() noexcept -> std::array<VkVertexInputBindingDescription, 2> {
 	std::array<VkVertexInputBindingDescription, 2> binding_descriptions {};
 	binding_descriptions[0].binding = 0;
-	binding_descriptions[0].stride = sizeof(Model::Vertex);
+	binding_descriptions[0].stride = sizeof(Model::PackedVertex);
 	binding_descriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 	binding_descriptions[1].binding = 1;
 	binding_descriptions[1].stride = sizeof(glm::mat4);
@@ -99,15 +121,15 @@ struct Scene {
 	attribute_descriptions[0].binding = 0;
 	attribute_descriptions[0].location = 0;
 	attribute_descriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-	attribute_descriptions[0].offset = offsetof(Model::Vertex, position);
+	attribute_descriptions[0].offset = offsetof(Model::PackedVertex, position);
 	attribute_descriptions[1].binding = 0;
 	attribute_descriptions[1].location = 1;
-	attribute_descriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-	attribute_descriptions[1].offset = offsetof(Model::Vertex, normal);
+	attribute_descriptions[1].format = VK_FORMAT_R16G16_SNORM;
+	attribute_descriptions[1].offset = offsetof(Model::PackedVertex, normal);
 	attribute_descriptions[2].binding = 0;
 	attribute_descriptions[2].location = 2;
-	attribute_descriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-	attribute_descriptions[2].offset = offsetof(Model::Vertex, texture);
+	attribute_descriptions[2].format = VK_FORMAT_R16G16_SFLOAT;
+	attribute_descriptions[2].offset = offsetof(Model::PackedVertex, texture);
 
 	for (uint32_t i = 0; i < 4; ++i) {
 	    attribute_descriptions[3 + i].binding = 1;
@@ -224,6 +224,8 @@ auto RenderContext::recreate_swapchain() noexcept -> void {
     update_descriptors_ray_trace_images();
     update_descriptors_motion_vector_texture();
     update_descriptors_taa_images();
+    // The cached passes bake in the old extent and descriptors.
+    cleanup_cached_passes();
 
     recreate_imgui();
 }
@@ -0,0 +1,537 @@
+/*
+ * This file is part of trace.
+ * trace is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ * trace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with trace. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+#include <cfloat>
+#include <cstdio>
+#include <array>
+#include <cmath>
+#include <bit>
+
+#include <stb/stb_image.h>
+
+#include "Tracy.hpp"
+
+#include "texture.h"
+
+static auto block_size(VkFormat format) noexcept -> std::size_t {
+    switch (format) {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+	return 8;
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+	return 16;
+    default:
+	return 0;
+    }
+}
+
+auto texture_level_size(VkFormat format, VkExtent2D extent, uint32_t level) noexcept -> std::size_t {
+    const std::size_t width = std::max(extent.width >> level, 1U);
+    const std::size_t height = std::max(extent.height >> level, 1U);
+    const std::size_t compressed_block_size = block_size(format);
+    if (compressed_block_size)
+	return ((width + 3) / 4) * ((height + 3) / 4) * compressed_block_size;
+    return width * height * 4;
+}
+
+auto texture_size(VkFormat format, VkExtent2D extent, uint32_t mip_levels) noexcept -> std::size_t {
+    std::size_t size = 0;
+    for (uint32_t level = 0; level < mip_levels; ++level)
+	size += texture_level_size(format, extent, level);
+    return size;
+}
+
+auto texture_mip_levels(VkExtent2D extent) noexcept -> uint32_t {
+    return std::min((uint32_t) std::bit_width(std::max(extent.width, extent.height)), TextureCacheHeader::MAX_MIP_LEVELS);
+}
+
+auto baked_texture_filepath(std::string_view png_filepath) noexcept -> std::string {
+    return std::filesystem::path(png_filepath).replace_extension(".tex").string();
+}
+
+auto bake_format_for_texture(std::string_view png_filepath) noexcept -> VkFormat {
+    const std::string stem = std::filesystem::path(png_filepath).stem().string();
+    auto ends_with = [&stem](std::string_view suffix) { return stem.size() >= suffix.size() && stem.compare(stem.size() - suffix.size(), suffix.size(), suffix) == 0; };
+    if (ends_with("PBRCOLOR"))
+	return VK_FORMAT_BC7_SRGB_BLOCK;
+    if (ends_with("PBRNORMAL"))
+	return VK_FORMAT_BC5_UNORM_BLOCK;
+    return VK_FORMAT_UNDEFINED;
+}
+
+static auto source_mtime(std::string_view png_filepath) noexcept -> int64_t {
+    std::error_code ec;
+    const auto mtime = std::filesystem::last_write_time(png_filepath, ec);
+    return ec ? -1 : (int64_t) mtime.time_since_epoch().count();
+}
+
+// Writes bits least significant first, as BC4 and BC7 blocks are laid out.
+struct BlockWriter {
+    uint8_t *dst;
+    uint32_t bit = 0;
+
+    auto write(uint32_t value, uint32_t num_bits) noexcept -> void {
+	for (uint32_t i = 0; i < num_bits; ++i, ++bit)
+	    if (value & (1U << i))
+		dst[bit / 8] |= (uint8_t) (1U << (bit % 8));
+    }
+};
+
+static auto encode_bc4_block(const std::array<uint8_t, 16> &values, uint8_t *dst) noexcept -> void {
+    memset(dst, 0, 8);
+    const uint8_t lo = *std::min_element(values.begin(), values.end());
+    const uint8_t hi = *std::max_element(values.begin(), values.end());
+    BlockWriter writer {dst};
+    writer.write(hi, 8);
+    writer.write(lo, 8);
+    if (hi == lo)
+	return;
+
+    // With red_0 > red_1, codes 0 and 1 are the endpoints and codes 2 to 7
+    // step from red_0 towards red_1 in sevenths.
+    std::array<int32_t, 8> palette;
+    palette[0] = hi;
+    palette[1] = lo;
+    for (int32_t i = 1; i < 7; ++i)
+	palette[i + 1] = ((7 - i) * hi + i * lo) / 7;
+    for (uint8_t value : values) {
+	uint32_t best_code = 0;
+	int32_t best_error = 256;
+	for (uint32_t code = 0; code < 8; ++code) {
+	    const int32_t error = std::abs(palette[code] - value);
+	    if (error < best_error) {
+		best_error = error;
+		best_code = code;
+	    }
+	}
+	writer.write(best_code, 3);
+    }
+}
+
+static const std::array<int32_t, 16> BC7_WEIGHTS = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+struct BC7Mode6Endpoints {
+    std::array<int32_t, 4> quantized[2];
+    int32_t p_bits[2];
+
+    auto endpoint(uint32_t e, uint32_t c) const noexcept -> int32_t {
+	return quantized[e][c] * 2 + p_bits[e];
+    }
+};
+
+static auto quantize_bc7_mode6_endpoint(const std::array<float, 4> &endpoint, std::array<int32_t, 4> &quantized) noexcept -> int32_t {
+    float best_error = FLT_MAX;
+    int32_t best_p_bit = 0;
+    for (int32_t p_bit = 0; p_bit < 2; ++p_bit) {
+	std::array<int32_t, 4> candidate;
+	float error = 0.0f;
+	for (uint32_t c = 0; c < 4; ++c) {
+	    candidate[c] = std::clamp((int32_t) std::lround((endpoint[c] - (float) p_bit) / 2.0f), 0, 127);
+	    const float difference = (float) (candidate[c] * 2 + p_bit) - endpoint[c];
+	    error += difference * difference;
+	}
+	if (error < best_error) {
+	    best_error = error;
+	    best_p_bit = p_bit;
+	    quantized = candidate;
+	}
+    }
+    return best_p_bit;
+}
+
+static auto index_bc7_mode6_block(const std::array<std::array<float, 4>, 16> &pixels, const BC7Mode6Endpoints &endpoints, std::array<uint32_t, 16> &indices) noexcept -> float {
+    std::array<std::array<int32_t, 4>, 16> palette;
+    for (uint32_t i = 0; i < 16; ++i)
+	for (uint32_t c = 0; c < 4; ++c)
+	    palette[i][c] = ((64 - BC7_WEIGHTS[i]) * endpoints.endpoint(0, c) + BC7_WEIGHTS[i] * endpoints.endpoint(1, c) + 32) >> 6;
+    float total_error = 0.0f;
+    for (uint32_t p = 0; p < 16; ++p) {
+	float best_error = FLT_MAX;
+	for (uint32_t i = 0; i < 16; ++i) {
+	    float error = 0.0f;
+	    for (uint32_t c = 0; c < 4; ++c) {
+		const float difference = (float) palette[i][c] - pixels[p][c];
+		error += difference * difference;
+	    }
+	    if (error < best_error) {
+		best_error = error;
+		indices[p] = i;
+	    }
+	}
+	total_error += best_error;
+    }
+    return total_error;
+}
+
+// BC7 mode 6: one subset, RGBA endpoints of 7 bits plus a shared low bit
+// each, and 4 bit indices. Endpoints start on the principal axis of the
+// block's colors, then get one least squares refit against the chosen indices.
+static auto encode_bc7_block(const std::array<std::array<uint8_t, 4>, 16> &rgba, uint8_t *dst) noexcept -> void {
+    std::array<std::array<float, 4>, 16> pixels;
+    std::array<float, 4> mean {};
+    for (uint32_t p = 0; p < 16; ++p)
+	for (uint32_t c = 0; c < 4; ++c) {
+	    pixels[p][c] = (float) rgba[p][c];
+	    mean[c] += pixels[p][c] / 16.0f;
+	}
+
+    float covariance[4][4] {};
+    for (const auto &pixel : pixels)
+	for (uint32_t i = 0; i < 4; ++i)
+	    for (uint32_t j = 0; j < 4; ++j)
+		covariance[i][j] += (pixel[i] - mean[i]) * (pixel[j] - mean[j]);
+    std::array<float, 4> axis = {1.0f, 1.0f, 1.0f, 1.0f};
+    for (uint32_t iteration = 0; iteration < 8; ++iteration) {
+	std::array<float, 4> next {};
+	for (uint32_t i = 0; i < 4; ++i)
+	    for (uint32_t j = 0; j < 4; ++j)
+		next[i] += covariance[i][j] * axis[j];
+	const float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2] + next[3] * next[3]);
+	if (length < 1e-6f)
+	    break;
+	for (uint32_t i = 0; i < 4; ++i)
+	    axis[i] = next[i] / length;
+    }
+
+    float t_min = FLT_MAX, t_max = -FLT_MAX;
+    for (const auto &pixel : pixels) {
+	float t = 0.0f;
+	for (uint32_t c = 0; c < 4; ++c)
+	    t += (pixel[c] - mean[c]) * axis[c];
+	t_min = std::min(t_min, t);
+	t_max = std::max(t_max, t);
+    }
+    std::array<float, 4> endpoint_colors[2];
+    for (uint32_t c = 0; c < 4; ++c) {
+	endpoint_colors[0][c] = std::clamp(mean[c] + t_min * axis[c], 0.0f, 255.0f);
+	endpoint_colors[1][c] = std::clamp(mean[c] + t_max * axis[c], 0.0f, 255.0f);
+    }
+
+    BC7Mode6Endpoints endpoints;
+    for (uint32_t e = 0; e < 2; ++e)
+	endpoints.p_bits[e] = quantize_bc7_mode6_endpoint(endpoint_colors[e], endpoints.quantized[e]);
+    std::array<uint32_t, 16> indices;
+    float error = index_bc7_mode6_block(pixels, endpoints, indices);
+
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    std::array<float, 4> ax {}, bx {};
+    for (uint32_t p = 0; p < 16; ++p) {
+	const float w = (float) BC7_WEIGHTS[indices[p]] / 64.0f;
+	aa += (1.0f - w) * (1.0f - w);
+	ab += (1.0f - w) * w;
+	bb += w * w;
+	for (uint32_t c = 0; c < 4; ++c) {
+	    ax[c] += (1.0f - w) * pixels[p][c];
+	    bx[c] += w * pixels[p][c];
+	}
+    }
+    const float determinant = aa * bb - ab * ab;
+    if (std::abs(determinant) > 1e-6f) {
+	std::array<float, 4> refit_colors[2];
+	for (uint32_t c = 0; c < 4; ++c) {
+	    refit_colors[0][c] = std::clamp((bb * ax[c] - ab * bx[c]) / determinant, 0.0f, 255.0f);
+	    refit_colors[1][c] = std::clamp((aa * bx[c] - ab * ax[c]) / determinant, 0.0f, 255.0f);
+	}
+	BC7Mode6Endpoints refit;
+	for (uint32_t e = 0; e < 2; ++e)
+	    refit.p_bits[e] = quantize_bc7_mode6_endpoint(refit_colors[e], refit.quantized[e]);
+	std::array<uint32_t, 16> refit_indices;
+	if (index_bc7_mode6_block(pixels, refit, refit_indices) < error) {
+	    endpoints = refit;
+	    indices = refit_indices;
+	}
+    }
+
+    // The first index's top bit is implicitly zero.
+    if (indices[0] & 8) {
+	std::swap(endpoints.quantized[0], endpoints.quantized[1]);
+	std::swap(endpoints.p_bits[0], endpoints.p_bits[1]);
+	for (auto &index : indices)
+	    index = 15 - index;
+    }
+
+    memset(dst, 0, 16);
+    BlockWriter writer {dst};
+    writer.write(1 << 6, 7);
+    for (uint32_t c = 0; c < 4; ++c) {
+	writer.write((uint32_t) endpoints.quantized[0][c], 7);
+	writer.write((uint32_t) endpoints.quantized[1][c], 7);
+    }
+    writer.write((uint32_t) endpoints.p_bits[0], 1);
+    writer.write((uint32_t) endpoints.p_bits[1], 1);
+    writer.write(indices[0], 3);
+    for (uint32_t p = 1; p < 16; ++p)
+	writer.write(indices[p], 4);
+}
+
+static auto srgb_to_linear(float srgb) noexcept -> float {
+    return srgb <= 0.04045f ? srgb / 12.92f : std::pow((srgb + 0.055f) / 1.055f, 2.4f);
+}
+
+static auto linear_to_srgb(float linear) noexcept -> float {
+    return linear <= 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+}
+
+// Halves an RGBA8 level with a box filter: in linear space for color,
+// renormalizing for normal maps, and plainly for everything else.
+static auto downsample_level(const std::vector<uint8_t> &src, VkExtent2D src_extent, bool srgb, bool normal_map) noexcept -> std::vector<uint8_t> {
+    const VkExtent2D dst_extent = {std::max(src_extent.width / 2, 1U), std::max(src_extent.height / 2, 1U)};
+    std::vector<uint8_t> dst((std::size_t) dst_extent.width * dst_extent.height * 4);
+    for (uint32_t y = 0; y < dst_extent.height; ++y) {
+	for (uint32_t x = 0; x < dst_extent.width; ++x) {
+	    std::array<float, 4> sum {};
+	    for (uint32_t dy = 0; dy < 2; ++dy) {
+		for (uint32_t dx = 0; dx < 2; ++dx) {
+		    const uint32_t sx = std::min(2 * x + dx, src_extent.width - 1);
+		    const uint32_t sy = std::min(2 * y + dy, src_extent.height - 1);
+		    const uint8_t *texel = &src[((std::size_t) sy * src_extent.width + sx) * 4];
+		    for (uint32_t c = 0; c < 4; ++c) {
+			const float value = (float) texel[c] / 255.0f;
+			sum[c] += srgb && c < 3 ? srgb_to_linear(value) : value;
+		    }
+		}
+	    }
+	    for (uint32_t c = 0; c < 4; ++c)
+		sum[c] /= 4.0f;
+	    if (srgb) {
+		for (uint32_t c = 0; c < 3; ++c)
+		    sum[c] = linear_to_srgb(sum[c]);
+	    } else if (normal_map) {
+		float normal[3], length = 0.0f;
+		for (uint32_t c = 0; c < 3; ++c) {
+		    normal[c] = sum[c] * 2.0f - 1.0f;
+		    length += normal[c] * normal[c];
+		}
+		length = std::sqrt(std::max(length, 1e-12f));
+		for (uint32_t c = 0; c < 3; ++c)
+		    sum[c] = (normal[c] / length) * 0.5f + 0.5f;
+	    }
+	    uint8_t *texel = &dst[((std::size_t) y * dst_extent.width + x) * 4];
+	    for (uint32_t c = 0; c < 4; ++c)
+		texel[c] = (uint8_t) std::lround(std::clamp(sum[c], 0.0f, 1.0f) * 255.0f);
+	}
+    }
+    return dst;
+}
+
+static auto encode_level(const std::vector<uint8_t> &rgba, VkExtent2D extent, VkFormat format, uint8_t *dst) noexcept -> void {
+    const uint32_t blocks_x = (extent.width + 3) / 4;
+    const uint32_t blocks_y = (extent.height + 3) / 4;
+    for (uint32_t block_y = 0; block_y < blocks_y; ++block_y) {
+	for (uint32_t block_x = 0; block_x < blocks_x; ++block_x) {
+	    // Blocks hanging off the edge repeat the last row and column.
+	    std::array<std::array<uint8_t, 4>, 16> block;
+	    for (uint32_t p = 0; p < 16; ++p) {
+		const uint32_t x = std::min(block_x * 4 + p % 4, extent.width - 1);
+		const uint32_t y = std::min(block_y * 4 + p / 4, extent.height - 1);
+		memcpy(block[p].data(), &rgba[((std::size_t) y * extent.width + x) * 4], 4);
+	    }
+
+	    if (format == VK_FORMAT_BC7_SRGB_BLOCK || format == VK_FORMAT_BC7_UNORM_BLOCK) {
+		encode_bc7_block(block, dst);
+	    } else {
+		for (uint32_t c = 0; c < (format == VK_FORMAT_BC5_UNORM_BLOCK ? 2U : 1U); ++c) {
+		    std::array<uint8_t, 16> channel;
+		    for (uint32_t p = 0; p < 16; ++p)
+			channel[p] = block[p][c];
+		    encode_bc4_block(channel, dst + 8 * c);
+		}
+	    }
+	    dst += block_size(format);
+	}
+    }
+}
+
+auto generate_texture_mips(const uint8_t *pixels, VkExtent2D extent, bool srgb, bool normal_map, BakedTexture &texture) noexcept -> void {
+    ZoneScoped;
+    texture.format = srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+    texture.extent = extent;
+    texture.mip_levels = texture_mip_levels(extent);
+    texture.data.resize(texture_size(texture.format, extent, texture.mip_levels));
+
+    std::vector<uint8_t> level_pixels(pixels, pixels + texture_level_size(texture.format, extent, 0));
+    VkExtent2D level_extent = extent;
+    std::size_t offset = 0;
+    for (uint32_t level = 0; level < texture.mip_levels; ++level) {
+	memcpy(&texture.data[offset], level_pixels.data(), level_pixels.size());
+	offset += level_pixels.size();
+	if (level + 1 < texture.mip_levels) {
+	    level_pixels = downsample_level(level_pixels, level_extent, srgb, normal_map);
+	    level_extent = {std::max(level_extent.width / 2, 1U), std::max(level_extent.height / 2, 1U)};
+	}
+    }
+}
+
+// Encodes a full mip chain from its top level and writes it to a temporary
+// file first, so a crashed bake never leaves a truncated .tex behind.
+static auto write_baked_texture(std::string_view baked_filepath, int64_t mtime, VkFormat format, std::vector<uint8_t> level_pixels, VkExtent2D extent, bool srgb, bool normal_map) noexcept -> bool {
+    TextureCacheHeader header {};
+    header.magic = TextureCacheHeader::MAGIC;
+    header.version = TextureCacheHeader::VERSION;
+    header.source_mtime = mtime;
+    header.format = (uint32_t) format;
+    header.width = extent.width;
+    header.height = extent.height;
+    header.mip_levels = texture_mip_levels(extent);
+
+    std::vector<uint8_t> data(texture_size(format, extent, header.mip_levels));
+    VkExtent2D level_extent = extent;
+    std::size_t offset = 0;
+    for (uint32_t level = 0; level < header.mip_levels; ++level) {
+	header.level_offsets[level] = sizeof(TextureCacheHeader) + offset;
+	header.level_sizes[level] = texture_level_size(format, extent, level);
+	encode_level(level_pixels, level_extent, format, &data[offset]);
+	offset += header.level_sizes[level];
+	if (level + 1 < header.mip_levels) {
+	    level_pixels = downsample_level(level_pixels, level_extent, srgb, normal_map);
+	    level_extent = {std::max(level_extent.width / 2, 1U), std::max(level_extent.height / 2, 1U)};
+	}
+    }
+
+    const std::string temp_filepath = std::string(baked_filepath) + ".tmp";
+    FILE *f = fopen(temp_filepath.c_str(), "w");
+    if (!f)
+	return false;
+    bool written = fwrite(&header, sizeof(TextureCacheHeader), 1, f) == 1;
+    written = written && fwrite(data.data(), 1, data.size(), f) == data.size();
+    written = fclose(f) == 0 && written;
+    if (!written || rename(temp_filepath.c_str(), &baked_filepath[0]) == -1) {
+	remove(temp_filepath.c_str());
+	return false;
+    }
+    return true;
+}
+
+static auto read_baked_texture_file(std::string_view baked_filepath, int64_t mtime, BakedTexture &texture) noexcept -> bool {
+    FILE *f = fopen(&baked_filepath[0], "r");
+    if (!f)
+	return false;
+
+    TextureCacheHeader header;
+    bool valid =
+	fread(&header, sizeof(TextureCacheHeader), 1, f) == 1 &&
+	header.magic == TextureCacheHeader::MAGIC &&
+	header.version == TextureCacheHeader::VERSION &&
+	header.source_mtime == mtime &&
+	header.mip_levels > 0 && header.mip_levels <= TextureCacheHeader::MAX_MIP_LEVELS &&
+	block_size((VkFormat) header.format) != 0;
+    if (valid) {
+	texture.format = (VkFormat) header.format;
+	texture.extent = {header.width, header.height};
+	texture.mip_levels = header.mip_levels;
+	texture.data.resize(texture_size(texture.format, texture.extent, texture.mip_levels));
+	valid = fread(texture.data.data(), 1, texture.data.size(), f) == texture.data.size();
+    }
+    fclose(f);
+    return valid;
+}
+
+auto bake_texture(std::string_view png_filepath, VkFormat format) noexcept -> bool {
+    ZoneScoped;
+    int tex_width, tex_height, tex_channels;
+    stbi_uc *pixels = stbi_load(&png_filepath[0], &tex_width, &tex_height, &tex_channels, STBI_rgb_alpha);
+    if (!pixels)
+	return false;
+    const VkExtent2D extent = {(uint32_t) tex_width, (uint32_t) tex_height};
+    std::vector<uint8_t> level_pixels(pixels, pixels + (std::size_t) tex_width * tex_height * 4);
+    stbi_image_free(pixels);
+
+    return write_baked_texture(baked_texture_filepath(png_filepath), source_mtime(png_filepath), format, std::move(level_pixels), extent, format == VK_FORMAT_BC7_SRGB_BLOCK, format == VK_FORMAT_BC5_UNORM_BLOCK);
+}
+
+auto read_baked_texture(std::string_view png_filepath, BakedTexture &texture) noexcept -> bool {
+    ZoneScoped;
+    return read_baked_texture_file(baked_texture_filepath(png_filepath), source_mtime(png_filepath), texture);
+}
+
+auto material_texture_paths(std::string_view obj_filepath) noexcept -> MaterialTexturePaths {
+    const std::filesystem::path obj_path(obj_filepath);
+    const std::string stem = (obj_path.parent_path() / obj_path.stem()).string();
+    auto find_source = [&](const char *suffix) {
+	const std::string filepath = stem + suffix + ".png";
+	if (std::filesystem::exists(filepath))
+	    return filepath;
+	return (obj_path.parent_path() / (std::string("DEFAULT") + suffix + ".png")).string();
+    };
+    return {find_source("PBRROUGH"), find_source("PBRMETAL"), stem + "PBRMATERIAL.tex"};
+}
+
+// Either source changing invalidates the bake, so fold both mtimes together.
+static auto material_source_mtime(const MaterialTexturePaths &paths) noexcept -> int64_t {
+    uint64_t mtime = (uint64_t) source_mtime(paths.roughness);
+    mtime = mtime * 1000003 ^ (uint64_t) source_mtime(paths.metallicity);
+    return (int64_t) mtime;
+}
+
+auto decode_material_texture(const MaterialTexturePaths &paths, std::vector<uint8_t> &rgba, VkExtent2D &extent) noexcept -> bool {
+    ZoneScoped;
+    struct Source {
+	stbi_uc *pixels;
+	int width, height;
+    };
+    std::array<Source, 2> sources {};
+    const std::array<const std::string *, 2> filepaths = {&paths.roughness, &paths.metallicity};
+    bool loaded = true;
+    extent = {1, 1};
+    for (uint32_t i = 0; i < 2; ++i) {
+	int channels;
+	sources[i].pixels = stbi_load(filepaths[i]->c_str(), &sources[i].width, &sources[i].height, &channels, STBI_rgb_alpha);
+	loaded = loaded && sources[i].pixels;
+	if (sources[i].pixels)
+	    extent = {std::max(extent.width, (uint32_t) sources[i].width), std::max(extent.height, (uint32_t) sources[i].height)};
+    }
+
+    // Sources of differing sizes are point sampled up to the largest of them.
+    // B is zeroed so the unbaked texture samples the same as the BC5 bake.
+    if (loaded) {
+	rgba.resize((std::size_t) extent.width * extent.height * 4);
+	for (uint32_t y = 0; y < extent.height; ++y) {
+	    for (uint32_t x = 0; x < extent.width; ++x) {
+		uint8_t *texel = &rgba[((std::size_t) y * extent.width + x) * 4];
+		for (uint32_t i = 0; i < 2; ++i) {
+		    const Source &source = sources[i];
+		    const std::size_t sx = (std::size_t) x * (std::size_t) source.width / extent.width;
+		    const std::size_t sy = (std::size_t) y * (std::size_t) source.height / extent.height;
+		    texel[i] = source.pixels[(sy * (std::size_t) source.width + sx) * 4];
+		}
+		texel[2] = 0;
+		texel[3] = 255;
+	    }
+	}
+    }
+    for (auto &source : sources)
+	if (source.pixels)
+	    stbi_image_free(source.pixels);
+    return loaded;
+}
+
+auto bake_material_texture(const MaterialTexturePaths &paths) noexcept -> bool {
+    ZoneScoped;
+    std::vector<uint8_t> rgba;
+    VkExtent2D extent;
+    if (!decode_material_texture(paths, rgba, extent))
+	return false;
+    return write_baked_texture(paths.baked, material_source_mtime(paths), VK_FORMAT_BC5_UNORM_BLOCK, std::move(rgba), extent, false, false);
+}
+
+auto read_baked_material_texture(const MaterialTexturePaths &paths, BakedTexture &texture) noexcept -> bool {
+    ZoneScoped;
+    return read_baked_texture_file(paths.baked, material_source_mtime(paths), texture);
+}
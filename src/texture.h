@@ -0,0 +1,90 @@
+/*
+ * This file is part of trace.
+ * trace is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ * trace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with trace. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <string_view>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// Baked textures live next to their .png as .tex files: a header with a
+// level index, then every mip level's blocks, largest first. Like baked
+// meshes, a .tex is only used while its source's mtime is unchanged.
+struct TextureCacheHeader {
+    static constexpr uint32_t MAGIC = 0x58455454; // "TTEX"
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t MAX_MIP_LEVELS = 16;
+
+    uint32_t magic;
+    uint32_t version;
+    int64_t source_mtime;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mip_levels;
+    uint64_t level_offsets[MAX_MIP_LEVELS];
+    uint64_t level_sizes[MAX_MIP_LEVELS];
+};
+
+struct BakedTexture {
+    VkFormat format;
+    VkExtent2D extent;
+    uint32_t mip_levels;
+    std::vector<uint8_t> data;
+};
+
+auto texture_level_size(VkFormat format, VkExtent2D extent, uint32_t level) noexcept -> std::size_t;
+
+auto texture_size(VkFormat format, VkExtent2D extent, uint32_t mip_levels) noexcept -> std::size_t;
+
+// Number of levels in a full mip chain, down to 1x1.
+auto texture_mip_levels(VkExtent2D extent) noexcept -> uint32_t;
+
+auto baked_texture_filepath(std::string_view png_filepath) noexcept -> std::string;
+
+// Picks the block format for a model texture from its PBR suffix, or returns
+// VK_FORMAT_UNDEFINED for textures that aren't baked on their own. Roughness
+// and metallicity maps are only baked packed into a material texture.
+auto bake_format_for_texture(std::string_view png_filepath) noexcept -> VkFormat;
+
+// Builds an uncompressed RGBA8 mip chain, filtered the same way baking filters,
+// for textures that weren't baked ahead of time.
+auto generate_texture_mips(const uint8_t *pixels, VkExtent2D extent, bool srgb, bool normal_map, BakedTexture &texture) noexcept -> void;
+
+auto bake_texture(std::string_view png_filepath, VkFormat format) noexcept -> bool;
+
+auto read_baked_texture(std::string_view png_filepath, BakedTexture &texture) noexcept -> bool;
+
+// A model's roughness and metallicity maps are packed into the R and G
+// channels of a single BC5 material texture. Missing maps fall back to the
+// DEFAULT ones. Ambient occlusion maps aren't used, since the path tracer
+// already accounts for occlusion.
+struct MaterialTexturePaths {
+    std::string roughness;
+    std::string metallicity;
+    std::string baked;
+};
+
+auto material_texture_paths(std::string_view obj_filepath) noexcept -> MaterialTexturePaths;
+
+auto decode_material_texture(const MaterialTexturePaths &paths, std::vector<uint8_t> &rgba, VkExtent2D &extent) noexcept -> bool;
+
+auto bake_material_texture(const MaterialTexturePaths &paths) noexcept -> bool;
+
+auto read_baked_material_texture(const MaterialTexturePaths &paths, BakedTexture &texture) noexcept -> bool;
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * This file is part of trace.
+ * trace is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ * trace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with trace. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include "Tracy.hpp"
+
+#include "mesh.h"
+
+auto print_usage() noexcept -> void {
+    std::cout << "Usage: bake_meshes <directory> [--force]\n";
+}
+
+auto main(int32_t argc, char **argv) noexcept -> int32_t {
+    ZoneScoped;
+    if (argc < 2 || argc > 3 || (argc == 3 && std::string_view(argv[2]) != "--force")) {
+	print_usage();
+	return 1;
+    }
+    const bool force = argc == 3;
+
+    uint32_t num_baked = 0, num_fresh = 0, num_failed = 0;
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(argv[1])) {
+	if (!entry.is_regular_file() || entry.path().extension() != ".obj")
+	    continue;
+	const std::string obj_filepath = entry.path().string();
+
+	Model model {};
+	if (!force && read_mesh_cache(obj_filepath, model)) {
+	    ++num_fresh;
+	    continue;
+	}
+
+	model = parse_obj_model(obj_filepath);
+	optimize_mesh(model);
+	if (write_mesh_cache(obj_filepath, model)) {
+	    std::cout << "INFO: Baked " << obj_filepath << " into " << mesh_cache_filepath(obj_filepath) << ", with " << model.vertices.size() << " vertices and " << model.indices.size() << " indices.\n";
+	    ++num_baked;
+	} else {
+	    std::cout << "ERROR: Couldn't write " << mesh_cache_filepath(obj_filepath) << ".\n";
+	    ++num_failed;
+	}
+    }
+
+    std::cout << "INFO: Baked " << num_baked << " meshes, " << num_fresh << " already up to date, " << num_failed << " failed.\n";
+    return num_failed ? 1 : 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * This file is part of trace.
+ * trace is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ * trace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with trace. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include "Tracy.hpp"
+
+#include "texture.h"
+
+auto print_usage() noexcept -> void {
+    std::cout << "Usage: bake_textures <directory> [--force]\n";
+}
+
+auto main(int32_t argc, char **argv) noexcept -> int32_t {
+    ZoneScoped;
+    if (argc < 2 || argc > 3 || (argc == 3 && std::string_view(argv[2]) != "--force")) {
+	print_usage();
+	return 1;
+    }
+    const bool force = argc == 3;
+
+    uint32_t num_baked = 0, num_fresh = 0, num_skipped = 0, num_failed = 0;
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(argv[1])) {
+	if (!entry.is_regular_file())
+	    continue;
+
+	// Each model's roughness, metallicity and occlusion maps bake into one
+	// packed material texture, found through the model's .obj.
+	if (entry.path().extension() == ".obj") {
+	    const MaterialTexturePaths paths = material_texture_paths(entry.path().string());
+	    BakedTexture texture {};
+	    if (!force && read_baked_material_texture(paths, texture)) {
+		++num_fresh;
+	    } else if (bake_material_texture(paths)) {
+		std::cout << "INFO: Baked " << paths.roughness << " and " << paths.metallicity << " into " << paths.baked << ".\n";
+		++num_baked;
+	    } else {
+		std::cout << "ERROR: Couldn't bake " << paths.baked << ".\n";
+		++num_failed;
+	    }
+	    continue;
+	}
+
+	if (entry.path().extension() != ".png")
+	    continue;
+	const std::string png_filepath = entry.path().string();
+
+	const VkFormat format = bake_format_for_texture(png_filepath);
+	if (format == VK_FORMAT_UNDEFINED) {
+	    ++num_skipped;
+	    continue;
+	}
+
+	BakedTexture texture {};
+	if (!force && read_baked_texture(png_filepath, texture)) {
+	    ++num_fresh;
+	    continue;
+	}
+
+	if (bake_texture(png_filepath, format)) {
+	    std::cout << "INFO: Baked " << png_filepath << " into " << baked_texture_filepath(png_filepath) << ".\n";
+	    ++num_baked;
+	} else {
+	    std::cout << "ERROR: Couldn't bake " << png_filepath << ".\n";
+	    ++num_failed;
+	}
+    }
+
+    std::cout << "INFO: Baked " << num_baked << " textures, " << num_fresh << " already up to date, " << num_skipped << " not bakeable, " << num_failed << " failed.\n";
+    return num_failed ? 1 : 0;
+}
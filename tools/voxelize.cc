@@ -16,6 +16,12 @@
 #include <iostream>
 #include <vector>
 #include <bitset>
+#include <algorithm>
+#include <pthread.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <math.h>
 
 #include <glm/glm.hpp>
@@ -29,11 +35,36 @@
 #include "util.h"
 
 #define NUM_THREADS 16
+#define BRICK_WIDTH 8
+#define OUTPUT_BUFFER_SIZE (1 << 20)
 
 static int32_t resolution;
+static bool use_mmap = false;
+static uint32_t brick_width;
+static uint64_t brick_volume;
 
 struct Triangle {
-    glm::vec3 a, b, c;
+    glm::vec3 axes[13];
+    float projected_min[13];
+    float projected_max[13];
+    float voxel_radius[13];
+    uint32_t negative_bound[3];
+    uint32_t positive_bound[3];
+};
+
+struct Brick {
+    uint64_t morton;
+    std::vector<uint32_t> triangles;
+    uint64_t occupancy[BRICK_WIDTH * BRICK_WIDTH * BRICK_WIDTH / 64];
+};
+
+struct OutputFile {
+    FILE *f;
+    int32_t fd;
+    uint8_t *mapped;
+    uint64_t size;
+    uint64_t offset;
+    std::vector<uint8_t> buffer;
 };
 
 struct Model {
@@ -60,14 +91,25 @@ struct WideSVONode {
     }
 
     bool operator==(const WideSVONode& other) const {
-	return leaf_data == other.leaf_data;
+	if (leaf != other.leaf) {
+	    return false;
+	}
+	if (leaf) {
+	    return leaf_data == other.leaf_data;
+	}
+	return parent.child_pointer == other.parent.child_pointer && parent.valid_mask == other.parent.valid_mask && parent.leaf_mask == other.parent.leaf_mask;
     }
 };
 
 static const WideSVONode EMPTY_WIDE_SVO_NODE = WideSVONode();
 
+#define SVO_NEAR_POINTER_LIMIT 0x7FFF
+
+// When far is set, child_pointer is instead the offset from this node to a 32-bit far
+// pointer slot, which holds the offset from this node to its first child.
 struct SVONodeParent {
-    uint32_t child_pointer: 16;
+    uint32_t child_pointer: 15;
+    uint32_t far: 1;
     uint32_t valid_mask: 8;
     uint32_t leaf_mask: 8;
 };
@@ -76,6 +118,7 @@ struct SVONode {
     union {
 	SVONodeParent parent;
 	uint32_t leaf_data;
+	uint32_t far_pointer;
     };
 
     bool operator==(const SVONode& other) const {
@@ -83,11 +126,17 @@ struct SVONode {
     }
 };
 
+static_assert(sizeof(SVONode) == 4);
+
 static const SVONode EMPTY_SVO_NODE = SVONode { };
 
+static std::vector<Triangle> triangles;
+static std::vector<Brick> bricks;
+static uint32_t thread_num_filled[NUM_THREADS];
+
 auto usage() noexcept -> void {
     ZoneScoped;
-    std::cout << "Usage: blue_noise_gen <obj model> <resolution>\n";
+    std::cout << "Usage: voxelize <obj model> <resolution> [--mmap]\n";
 }
 
 auto load_obj_model(std::string_view obj_filepath) noexcept -> Model {
@@ -150,61 +199,59 @@ auto load_obj_model(std::string_view obj_filepath) noexcept -> Model {
     return model;
 }
 
-bool tri_aabb_sat(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, glm::vec3 aabb, glm::vec3 axis) {
-    float p0 = glm::dot(v0, axis);
-    float p1 = glm::dot(v1, axis);
-    float p2 = glm::dot(v2, axis);
-
-    float r = aabb.x * glm::abs(glm::dot(glm::vec3(1, 0, 0), axis)) +
-        aabb.y * glm::abs(glm::dot(glm::vec3(0, 1, 0), axis)) +
-        aabb.z * glm::abs(glm::dot(glm::vec3(0, 0, 1), axis));
+auto prepare_triangle(glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 voxel_extents) noexcept -> Triangle {
+    Triangle triangle {};
+    glm::vec3 edges[3] = {b - a, c - b, a - c};
+    for (uint32_t i = 0; i < 3; ++i) {
+	triangle.axes[i] = glm::vec3(0.0f, -edges[i].z, edges[i].y);
+	triangle.axes[3 + i] = glm::vec3(edges[i].z, 0.0f, -edges[i].x);
+	triangle.axes[6 + i] = glm::vec3(-edges[i].y, edges[i].x, 0.0f);
+    }
+    triangle.axes[9] = glm::vec3(1.0f, 0.0f, 0.0f);
+    triangle.axes[10] = glm::vec3(0.0f, 1.0f, 0.0f);
+    triangle.axes[11] = glm::vec3(0.0f, 0.0f, 1.0f);
+    triangle.axes[12] = glm::cross(edges[0], edges[1]);
+
+    // SAT is scale invariant per axis, so the edges don't need normalizing. Project the
+    // triangle and the voxel half extents once here, so testing a voxel is 13 dot products.
+    for (uint32_t i = 0; i < 13; ++i) {
+	float p0 = glm::dot(a, triangle.axes[i]);
+	float p1 = glm::dot(b, triangle.axes[i]);
+	float p2 = glm::dot(c, triangle.axes[i]);
+	triangle.projected_min[i] = glm::min(p0, glm::min(p1, p2));
+	triangle.projected_max[i] = glm::max(p0, glm::max(p1, p2));
+	triangle.voxel_radius[i] = glm::dot(voxel_extents, glm::abs(triangle.axes[i]));
+    }
 
-    float maxP = glm::max(p0, glm::max(p1, p2));
-    float minP = glm::min(p0, glm::min(p1, p2));
+    glm::vec3 negative_bound = glm::min(a, glm::min(b, c));
+    glm::vec3 positive_bound = glm::max(a, glm::max(b, c));
+    float max_coord = (float) resolution - 1.0f;
+    for (int32_t i = 0; i < 3; ++i) {
+	triangle.negative_bound[i] = (uint32_t) fmin(fmax(negative_bound[i], 0.0f), max_coord);
+	triangle.positive_bound[i] = (uint32_t) fmin(fmax(positive_bound[i], 0.0f), max_coord);
+    }
 
-    return !(glm::max(-maxP, minP) > r);
+    return triangle;
 }
 
-bool tri_aabb(Triangle &triangle, glm::vec3 aabb_center, glm::vec3 aabb_extents) {
-    triangle.a -= aabb_center;
-    triangle.b -= aabb_center;
-    triangle.c -= aabb_center;
-
-    glm::vec3 ab = glm::normalize(triangle.b - triangle.a);
-    glm::vec3 bc = glm::normalize(triangle.c - triangle.b);
-    glm::vec3 ca = glm::normalize(triangle.a - triangle.c);
-
-    glm::vec3 a00 = glm::vec3(0.0, -ab.z, ab.y);
-    glm::vec3 a01 = glm::vec3(0.0, -bc.z, bc.y);
-    glm::vec3 a02 = glm::vec3(0.0, -ca.z, ca.y);
-
-    glm::vec3 a10 = glm::vec3(ab.z, 0.0, -ab.x);
-    glm::vec3 a11 = glm::vec3(bc.z, 0.0, -bc.x);
-    glm::vec3 a12 = glm::vec3(ca.z, 0.0, -ca.x);
-
-    glm::vec3 a20 = glm::vec3(-ab.y, ab.x, 0.0);
-    glm::vec3 a21 = glm::vec3(-bc.y, bc.x, 0.0);
-    glm::vec3 a22 = glm::vec3(-ca.y, ca.x, 0.0);
-
-    if (
-        !tri_aabb_sat(triangle.a, triangle.b, triangle.c, aabb_extents, a00) ||
-        !tri_aabb_sat(triangle.a, triangle.b, triangle.c, aabb_extents, a01) ||
-        !tri_aabb_sat(triangle.a, triangle.b, triangle.c, aabb_extents, a02) ||
-        !tri_aabb_sat(triangle.a, triangle.b, triangle.c, aabb_extents, a10) ||
-        !tri_aabb_sat(triangle.a, triangle.b, triangle.c, aabb_extents, a11) ||
-        !tri_aabb_sat(triangle.a, triangle.b, triangle.c, aabb_extents, a12) ||
-        !tri_aabb_sat(triangle.a, triangle.b, triangle.c, aabb_extents, a20) ||
-        !tri_aabb_sat(triangle.a, triangle.b, triangle.c, aabb_extents, a21) ||
-        !tri_aabb_sat(triangle.a, triangle.b, triangle.c, aabb_extents, a22) ||
-        !tri_aabb_sat(triangle.a, triangle.b, triangle.c, aabb_extents, glm::vec3(1, 0, 0)) ||
-        !tri_aabb_sat(triangle.a, triangle.b, triangle.c, aabb_extents, glm::vec3(0, 1, 0)) ||
-        !tri_aabb_sat(triangle.a, triangle.b, triangle.c, aabb_extents, glm::vec3(0, 0, 1)) ||
-        !tri_aabb_sat(triangle.a, triangle.b, triangle.c, aabb_extents, glm::cross(ab, bc))
-    )
-    {
-        return false;
+auto tri_voxel(const Triangle &triangle, glm::vec3 voxel_center) noexcept -> bool {
+    for (uint32_t i = 0; i < 13; ++i) {
+	float p = glm::dot(voxel_center, triangle.axes[i]);
+	if (glm::max(p - triangle.projected_max[i], triangle.projected_min[i] - p) > triangle.voxel_radius[i]) {
+	    return false;
+	}
     }
+    return true;
+}
 
+auto tri_aabb(const Triangle &triangle, glm::vec3 aabb_center, glm::vec3 aabb_extents) noexcept -> bool {
+    for (uint32_t i = 0; i < 13; ++i) {
+	float p = glm::dot(aabb_center, triangle.axes[i]);
+	float r = glm::dot(aabb_extents, glm::abs(triangle.axes[i]));
+	if (glm::max(p - triangle.projected_max[i], triangle.projected_min[i] - p) > r) {
+	    return false;
+	}
+    }
     return true;
 }
 
@@ -224,6 +271,22 @@ uint64_t morton_encode(uint32_t x, uint32_t y, uint32_t z) {
     return answer;
 }
 
+uint32_t compact_by_3(uint64_t x) {
+    x &= 0x1249249249249249;
+    x = (x | x >> 2) & 0x10c30c30c30c30c3;
+    x = (x | x >> 4) & 0x100f00f00f00f00f;
+    x = (x | x >> 8) & 0x1f0000ff0000ff;
+    x = (x | x >> 16) & 0x1f00000000ffff;
+    x = (x | x >> 32) & 0x1fffff;
+    return (uint32_t) x;
+}
+
+void morton_decode(uint64_t morton, uint32_t &x, uint32_t &y, uint32_t &z) {
+    x = compact_by_3(morton);
+    y = compact_by_3(morton >> 1);
+    z = compact_by_3(morton >> 2);
+}
+
 uint8_t reverse(uint8_t b) {
    b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
    b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
@@ -260,10 +323,17 @@ void dump_svo_child(const std::vector<SVONode> &svo, uint64_t node, int32_t dept
     std::cout << "CHILD (node " << node << ", depth " << depth << "): " << std::hex << svo[node].leaf_data << std::dec << "\n";
 }
 
+uint64_t svo_child_pointer(const std::vector<SVONode> &svo, uint64_t node) {
+    if (svo[node].parent.far) {
+	return node + svo[node + svo[node].parent.child_pointer].far_pointer;
+    }
+    return node + svo[node].parent.child_pointer;
+}
+
 void dump_svo_parent(const std::vector<SVONode> &svo, uint64_t node, int32_t depth) {
-    std::cout << "PARENT (node " << node << ", depth " << depth <<  "): " << svo[node].parent.child_pointer << " " << std::bitset<8>(svo[node].parent.valid_mask) << " " << std::bitset<8>(svo[node].parent.leaf_mask) << "\n";
+    std::cout << "PARENT (node " << node << ", depth " << depth <<  "): " << svo_child_pointer(svo, node) - node << (svo[node].parent.far ? " (far) " : " ") << std::bitset<8>(svo[node].parent.valid_mask) << " " << std::bitset<8>(svo[node].parent.leaf_mask) << "\n";
     for (uint8_t i = 0, j = 0; i < 8; ++i) {
-	uint64_t child_pointer = node + svo[node].parent.child_pointer + j;
+	uint64_t child_pointer = svo_child_pointer(svo, node) + j;
 	uint8_t valid = svo[node].parent.valid_mask;
 	uint8_t leaf = svo[node].parent.leaf_mask;
 	if (valid & (1 << i)) {
@@ -281,10 +351,174 @@ void dump_svo(const std::vector<SVONode> &svo) {
     dump_svo_parent(svo, 0, 0);
 }
 
+bool validate_svo_parent(const std::vector<SVONode> &svo, std::vector<bool> &reached, uint64_t node, int32_t depth, int32_t max_depth, uint64_t &num_leaves) {
+    if (depth >= max_depth) {
+	std::cerr << "ERROR: Parent node " << node << " is deeper than the maximum depth.\n";
+	return false;
+    }
+    uint64_t child_pointer;
+    if (svo[node].parent.far) {
+	uint64_t slot = node + svo[node].parent.child_pointer;
+	if (slot >= svo.size() || reached[slot]) {
+	    std::cerr << "ERROR: Far pointer slot of node " << node << " is out of range or shared.\n";
+	    return false;
+	}
+	reached[slot] = true;
+	child_pointer = node + svo[slot].far_pointer;
+    } else {
+	child_pointer = node + svo[node].parent.child_pointer;
+    }
+    uint8_t valid = svo[node].parent.valid_mask;
+    uint8_t leaf = svo[node].parent.leaf_mask;
+    if ((leaf & ~valid) != 0) {
+	std::cerr << "ERROR: Node " << node << " has leaf bits set for invalid children.\n";
+	return false;
+    }
+    for (uint8_t i = 0, j = 0; i < 8; ++i) {
+	if (valid & (1 << i)) {
+	    uint64_t child = child_pointer + j;
+	    if (child <= node || child >= svo.size() || reached[child]) {
+		std::cerr << "ERROR: Child " << (uint32_t) j << " of node " << node << " is out of range or already reached.\n";
+		return false;
+	    }
+	    reached[child] = true;
+	    if (leaf & (1 << i)) {
+		++num_leaves;
+	    } else if (!validate_svo_parent(svo, reached, child, depth + 1, max_depth, num_leaves)) {
+		return false;
+	    }
+	    ++j;
+	}
+    }
+    return true;
+}
+
+// Checks that every node and far pointer slot is reached exactly once from the root, and
+// that the tree holds as many leaves as the wide SVO it was compacted from.
+bool validate_svo(const std::vector<SVONode> &svo, int32_t max_depth, uint64_t expected_leaves) {
+    std::vector<bool> reached(svo.size(), false);
+    uint64_t num_leaves = 0;
+    reached[0] = true;
+    if (!validate_svo_parent(svo, reached, 0, 0, max_depth, num_leaves)) {
+	return false;
+    }
+    for (uint64_t i = 0; i < svo.size(); ++i) {
+	if (!reached[i]) {
+	    std::cerr << "ERROR: Node " << i << " is unreachable.\n";
+	    return false;
+	}
+    }
+    if (num_leaves != expected_leaves) {
+	std::cerr << "ERROR: Found " << num_leaves << " leaves, expected " << expected_leaves << ".\n";
+	return false;
+    }
+    return true;
+}
+
+// Output sizes are always known up front, so the file is either mapped at its final size
+// and filled in one sequential pass, or written through a large staging buffer.
+auto open_output_file(const std::string &path, uint64_t size) noexcept -> OutputFile {
+    ZoneScoped;
+    OutputFile output {};
+    output.size = size;
+    if (use_mmap) {
+	output.fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	ASSERT(output.fd, "Couldn't open output file.");
+	ASSERT(ftruncate(output.fd, (off_t) size), "Couldn't resize output file.");
+	void *mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, output.fd, 0);
+	ASSERT(mapped != MAP_FAILED, "Couldn't map output file.");
+	output.mapped = (uint8_t *) mapped;
+    } else {
+	output.f = fopen(path.c_str(), "w");
+	ASSERT(output.f, "Couldn't open output file.");
+	output.buffer.reserve(OUTPUT_BUFFER_SIZE);
+    }
+    return output;
+}
+
+auto write_output_file(OutputFile &output, const void *data, uint64_t size) noexcept -> void {
+    ASSERT(output.offset + size <= output.size, "Wrote past the expected end of output file.");
+    if (output.mapped) {
+	memcpy(output.mapped + output.offset, data, size);
+    } else {
+	if (output.buffer.size() + size > OUTPUT_BUFFER_SIZE) {
+	    fwrite(output.buffer.data(), 1, output.buffer.size(), output.f);
+	    output.buffer.clear();
+	}
+	if (size > OUTPUT_BUFFER_SIZE) {
+	    fwrite(data, 1, size, output.f);
+	} else {
+	    output.buffer.insert(output.buffer.end(), (const uint8_t *) data, (const uint8_t *) data + size);
+	}
+    }
+    output.offset += size;
+}
+
+auto write_output_chunk_header(OutputFile &output, const char id[4], uint32_t content_size, uint32_t children_size) noexcept -> void {
+    uint32_t header[3];
+    memcpy(&header[0], id, 4);
+    header[1] = content_size;
+    header[2] = children_size;
+    write_output_file(output, header, sizeof(header));
+}
+
+auto close_output_file(OutputFile &output) noexcept -> void {
+    ZoneScoped;
+    ASSERT(output.offset == output.size, "Output file size doesn't match what was written.");
+    if (output.mapped) {
+	ASSERT(munmap(output.mapped, output.size), "Couldn't unmap output file.");
+	ASSERT(close(output.fd), "Couldn't close output file.");
+    } else {
+	fwrite(output.buffer.data(), 1, output.buffer.size(), output.f);
+	fclose(output.f);
+    }
+}
+
+auto voxelize_worker(void *thread_id_ptr) -> void * {
+    int32_t thread_id = *((int32_t *) thread_id_ptr);
+    uint32_t num_filled = 0;
+    // Each brick owns its occupancy bits, so threads never write to shared memory.
+    for (size_t i = (size_t) thread_id; i < bricks.size(); i += NUM_THREADS) {
+	Brick &brick = bricks[i];
+	uint32_t brick_min[3];
+	morton_decode(brick.morton, brick_min[0], brick_min[1], brick_min[2]);
+	for (int32_t j = 0; j < 3; ++j) {
+	    brick_min[j] *= brick_width;
+	}
+	uint32_t brick_max[3] = {brick_min[0] + brick_width - 1, brick_min[1] + brick_width - 1, brick_min[2] + brick_width - 1};
+	for (uint32_t triangle_id : brick.triangles) {
+	    const Triangle &triangle = triangles[triangle_id];
+	    uint32_t lo[3], hi[3];
+	    for (int32_t j = 0; j < 3; ++j) {
+		lo[j] = std::max(brick_min[j], triangle.negative_bound[j]);
+		hi[j] = std::min(brick_max[j], triangle.positive_bound[j]);
+	    }
+	    for (uint32_t x = lo[0]; x <= hi[0]; ++x) {
+		for (uint32_t y = lo[1]; y <= hi[1]; ++y) {
+		    for (uint32_t z = lo[2]; z <= hi[2]; ++z) {
+			uint64_t brick_idx = morton_encode(x, y, z) & (brick_volume - 1);
+			uint64_t bit = 1ull << (brick_idx & 63);
+			if (!(brick.occupancy[brick_idx >> 6] & bit) && tri_voxel(triangle, glm::vec3((float) x + 0.5f, (float) y + 0.5f, (float) z + 0.5f))) {
+			    ++num_filled;
+			    brick.occupancy[brick_idx >> 6] |= bit;
+			}
+		    }
+		}
+	    }
+	}
+	brick.triangles.clear();
+	brick.triangles.shrink_to_fit();
+    }
+    thread_num_filled[thread_id] = num_filled;
+    return NULL;
+}
+
 auto main(int32_t argc, char **argv) noexcept -> int32_t {
     ZoneScoped;
     FrameMark;
-    if (argc != 3) {
+    if (argc == 4 && std::string_view(argv[3]) == "--mmap") {
+	use_mmap = true;
+    } else if (argc != 3) {
 	usage();
 	exit(1);
     }
@@ -299,85 +533,92 @@ auto main(int32_t argc, char **argv) noexcept -> int32_t {
     Model model = load_obj_model(argv[1]);
     std::cout << "Voxelizing " << argv[1] << " at resolution of " << resolution << "^3 voxels.\n";
 
-    std::vector<bool> voxel_grid(resolution * resolution * resolution, false);
-    uint32_t num_filled = 0;
-    for (uint32_t i = 0; i < model.indices.size() - 2; i += 3) {
-	glm::vec3 tri[3];
-	tri[0] = model.vertices[model.indices[i]];
-	tri[1] = model.vertices[model.indices[i + 1]];
-	tri[2] = model.vertices[model.indices[i + 2]];
-	glm::vec3 negative_bound;
-	negative_bound.x = fmin(fmin(tri[0].x, tri[1].x), tri[2].x);
-	negative_bound.y = fmin(fmin(tri[0].y, tri[1].y), tri[2].y);
-	negative_bound.z = fmin(fmin(tri[0].z, tri[1].z), tri[2].z);
-	glm::vec3 positive_bound;
-	positive_bound.x = fmax(fmax(tri[0].x, tri[1].x), tri[2].x);
-	positive_bound.y = fmax(fmax(tri[0].y, tri[1].y), tri[2].y);
-	positive_bound.z = fmax(fmax(tri[0].z, tri[1].z), tri[2].z);
-	auto min = [](uint32_t x, uint32_t y) {
-	    return x < y ? x : y;
-	};
-	auto max = [](uint32_t x, uint32_t y) {
-	    return x > y ? x : y;
-	};
-	uint32_t negative_bound_fixed[3] = { min(max((uint32_t) negative_bound.x, 0), (uint32_t) resolution - 1), min(max((uint32_t) negative_bound.y, 0), (uint32_t) resolution - 1), min(max((uint32_t) negative_bound.z, 0), (uint32_t) resolution - 1)};
-	uint32_t positive_bound_fixed[3] = { min(max((uint32_t) positive_bound.x, 0), (uint32_t) resolution - 1), min(max((uint32_t) positive_bound.y, 0), (uint32_t) resolution - 1), min(max((uint32_t) positive_bound.z, 0), (uint32_t) resolution - 1)};
-	Triangle &triangle = *((Triangle *) &tri);
-	for (uint32_t x = negative_bound_fixed[0]; x <= positive_bound_fixed[0]; ++x) {
-	    for (uint32_t y = negative_bound_fixed[1]; y <= positive_bound_fixed[1]; ++y) {
-		for (uint32_t z = negative_bound_fixed[2]; z <= positive_bound_fixed[2]; ++z) {
-		    uint64_t voxel_grid_idx = morton_encode(x, y, z);
-		    if (!voxel_grid[voxel_grid_idx] && tri_aabb(triangle, glm::vec3((float) x + 0.5f, (float) y + 0.5f, (float) z + 0.5f), glm::vec3(1.0f))) {
-			++num_filled;
-			voxel_grid[voxel_grid_idx] = true;
+    brick_width = (uint32_t) std::min(resolution, BRICK_WIDTH);
+    brick_volume = (uint64_t) brick_width * brick_width * brick_width;
+    triangles.reserve(model.indices.size() / 3);
+    for (uint32_t i = 0; i + 2 < model.indices.size(); i += 3) {
+	triangles.push_back(prepare_triangle(model.vertices[model.indices[i]], model.vertices[model.indices[i + 1]], model.vertices[model.indices[i + 2]], glm::vec3(1.0f)));
+    }
+
+    std::unordered_map<uint64_t, std::vector<uint32_t>> brick_bins;
+    glm::vec3 brick_extents = glm::vec3((float) brick_width * 0.5f + 0.5f);
+    for (uint32_t i = 0; i < triangles.size(); ++i) {
+	const Triangle &triangle = triangles[i];
+	for (uint32_t x = triangle.negative_bound[0] / brick_width; x <= triangle.positive_bound[0] / brick_width; ++x) {
+	    for (uint32_t y = triangle.negative_bound[1] / brick_width; y <= triangle.positive_bound[1] / brick_width; ++y) {
+		for (uint32_t z = triangle.negative_bound[2] / brick_width; z <= triangle.positive_bound[2] / brick_width; ++z) {
+		    glm::vec3 brick_center = (glm::vec3((float) x, (float) y, (float) z) + 0.5f) * (float) brick_width;
+		    if (tri_aabb(triangle, brick_center, brick_extents)) {
+			brick_bins[morton_encode(x, y, z)].push_back(i);
 		    }
 		}
 	    }
 	}
     }
-
-    std::string output_file = std::string(argv[1]) + ".vox";
-    FILE *f = fopen(output_file.c_str(), "w");
-    ASSERT(f, "Couldn't open .vox file.");
-    fwrite("VOX ", 1, 4, f);
+    bricks.reserve(brick_bins.size());
+    for (auto &[morton, brick_triangles] : brick_bins) {
+	Brick brick {};
+	brick.morton = morton;
+	brick.triangles = std::move(brick_triangles);
+	bricks.push_back(std::move(brick));
+    }
+    std::sort(bricks.begin(), bricks.end(), [](const Brick &a, const Brick &b) { return a.morton < b.morton; });
+    std::cout << "Binned " << triangles.size() << " triangles into " << bricks.size() << " bricks of " << brick_width << "^3 voxels.\n";
+
+    pthread_t threads[NUM_THREADS];
+    int32_t thread_ids[NUM_THREADS];
+    for (int32_t i = 0; i < NUM_THREADS; ++i) {
+	thread_ids[i] = i;
+	pthread_create(&threads[i], NULL, voxelize_worker, (void *) &thread_ids[i]);
+    }
+    uint32_t num_filled = 0;
+    for (int32_t i = 0; i < NUM_THREADS; ++i) {
+	pthread_join(threads[i], NULL);
+	num_filled += thread_num_filled[i];
+    }
+    std::erase_if(bricks, [](const Brick &brick) {
+	for (uint64_t word : brick.occupancy) {
+	    if (word) {
+		return false;
+	    }
+	}
+	return true;
+    });
+
+    uint32_t size_chunk_size = 3 * sizeof(uint32_t);
+    uint32_t xyzi_chunk_size = (num_filled + 1) * sizeof(uint32_t);
+    uint32_t rgba_chunk_size = 256 * sizeof(uint32_t);
+    uint32_t main_children_size = 3 * 12 + size_chunk_size + xyzi_chunk_size + rgba_chunk_size;
+    OutputFile vox_file = open_output_file(std::string(argv[1]) + ".vox", 8 + 12 + main_children_size);
+    write_output_file(vox_file, "VOX ", 4);
     uint32_t version = 150;
-    fwrite(&version, 1, 4, f);
-    fwrite("MAIN", 1, 4, f);
-    uint32_t main_size = 0;
-    fwrite(&main_size, 1, 4, f);
-    fwrite(&main_size, 1, 4, f); // TODO: Write proper main child chunks size
-    fwrite("SIZE", 1, 4, f);
-    fwrite(&main_size, 1, 4, f); // TODO: Write proper size chunk size
-    fwrite(&main_size, 1, 4, f);
-    fwrite(&resolution, 1, 4, f);
-    fwrite(&resolution, 1, 4, f);
-    fwrite(&resolution, 1, 4, f);
-    fwrite("XYZI", 1, 4, f);
-    uint32_t xyzi_size = num_filled * 4 + 4;
-    fwrite(&xyzi_size, 1, 4, f);
-    fwrite(&main_size, 1, 4, f); // TODO: Write proper xyzi child chunks size
-    uint32_t num_voxels = num_filled;
-    fwrite(&num_voxels, 1, 4, f);
-    for (int32_t x = 0; x < resolution; ++x) {
-	for (int32_t y = 0; y < resolution; ++y) {
-	    for (int32_t z = 0; z < resolution; ++z) {
-		uint64_t voxel_grid_idx = morton_encode(x, y, z);
-		if (voxel_grid[voxel_grid_idx]) {
-		    uint8_t voxel[4] = {(uint8_t) z, (uint8_t) y, (uint8_t) x, 1};
-		    fwrite(voxel, 1, 4, f);
-		}
+    write_output_file(vox_file, &version, 4);
+    write_output_chunk_header(vox_file, "MAIN", 0, main_children_size);
+    write_output_chunk_header(vox_file, "SIZE", size_chunk_size, 0);
+    uint32_t dimensions[3] = {(uint32_t) resolution, (uint32_t) resolution, (uint32_t) resolution};
+    write_output_file(vox_file, dimensions, sizeof(dimensions));
+    write_output_chunk_header(vox_file, "XYZI", xyzi_chunk_size, 0);
+    write_output_file(vox_file, &num_filled, 4);
+    std::vector<uint32_t> brick_voxels;
+    brick_voxels.reserve(brick_volume);
+    for (const auto &brick : bricks) {
+	brick_voxels.clear();
+	for (uint64_t word = 0; word < (brick_volume + 63) / 64; ++word) {
+	    for (uint64_t bits = brick.occupancy[word]; bits; bits &= bits - 1) {
+		uint32_t x, y, z;
+		morton_decode(brick.morton * brick_volume + word * 64 + (uint64_t) __builtin_ctzll(bits), x, y, z);
+		brick_voxels.push_back((z & 0xFF) | (y & 0xFF) << 8 | (x & 0xFF) << 16 | 1 << 24);
 	    }
 	}
+	write_output_file(vox_file, brick_voxels.data(), brick_voxels.size() * sizeof(uint32_t));
     }
-    fwrite("RGBA", 1, 4, f);
-    fwrite(&main_size, 1, 4, f); // TODO: Write proper rgba chunk size
-    fwrite(&main_size, 1, 4, f); // TODO: Write proper rgba child chunks size
+    write_output_chunk_header(vox_file, "RGBA", rgba_chunk_size, 0);
+    uint32_t palette[256];
     for (uint32_t i = 0; i < 256; ++i) {
-	uint32_t color = 0xFFFFFFFF;
-	fwrite(&color, 1, 4, f);
+	palette[i] = 0xFFFFFFFF;
     }
-    
-    fclose(f);
+    write_output_file(vox_file, palette, sizeof(palette));
+    close_output_file(vox_file);
 
     int32_t d_max_depth = (int32_t) log2(resolution);
     std::vector<std::vector<WideSVONode>> queues(d_max_depth + 1);
@@ -411,59 +652,117 @@ auto main(int32_t argc, char **argv) noexcept -> int32_t {
 	    --d;
 	}
     };
-    uint64_t current_morton = 0;
-    uint64_t morton_limit = (uint64_t) resolution * (uint64_t) resolution * (uint64_t) resolution;
-    for (uint64_t morton = 0; morton < morton_limit; ++morton) {
-	if (!voxel_grid[morton]) {
-	    continue;
+    // Pushes count empty leaves starting at leaf position, as whole empty subtrees
+    // wherever the run is aligned, so a gap costs O(depth) rather than O(count).
+    auto push_empty = [&](uint64_t position, uint64_t count) {
+	while (count > 0) {
+	    int32_t level = 0;
+	    while (level < d_max_depth && (position & ((8ull << (3 * level)) - 1)) == 0 && (8ull << (3 * level)) <= count) {
+		++level;
+	    }
+	    queues[d_max_depth - level].push_back(EMPTY_WIDE_SVO_NODE);
+	    flush(d_max_depth - level);
+	    position += 1ull << (3 * level);
+	    count -= 1ull << (3 * level);
 	}
-	uint32_t leaf_voxel = 0xFFFFFFFF;
-	uint64_t num_empty_nodes = morton - current_morton;
-	for (uint64_t i = 1; i < num_empty_nodes; ++i) {
-	    queues[d_max_depth].push_back(EMPTY_WIDE_SVO_NODE);
-	    flush(d_max_depth);
+    };
+    uint64_t next_morton = 0;
+    uint64_t morton_limit = (uint64_t) resolution * (uint64_t) resolution * (uint64_t) resolution;
+    for (const auto &brick : bricks) {
+	for (uint64_t word = 0; word < (brick_volume + 63) / 64; ++word) {
+	    for (uint64_t bits = brick.occupancy[word]; bits; bits &= bits - 1) {
+		uint64_t morton = brick.morton * brick_volume + word * 64 + (uint64_t) __builtin_ctzll(bits);
+		push_empty(next_morton, morton - next_morton);
+		WideSVONode leaf_node {};
+		leaf_node.leaf_data = 0xFFFFFFFF;
+		queues[d_max_depth].push_back(leaf_node);
+		flush(d_max_depth);
+		next_morton = morton + 1;
+	    }
 	}
-	WideSVONode leaf_node {};
-	leaf_node.leaf_data = leaf_voxel;
-	queues[d_max_depth].push_back(leaf_node);
-	flush(d_max_depth);
-	current_morton = morton;
-    }
-    uint64_t num_empty_nodes = morton_limit - current_morton;
-    for (uint64_t i = 0; i < num_empty_nodes; ++i) {
-	queues[d_max_depth].push_back(EMPTY_WIDE_SVO_NODE);
-	flush(d_max_depth);
     }
+    push_empty(next_morton, morton_limit - next_morton);
     wide_svo.push_back(queues[0][0]);
 
     dump_wide_svo(wide_svo);
 
     std::cout << "\n<<<<<<<<<<<<<<<<<<<<<<\n\n";
 
-    std::vector<SVONode> svo;
-    for (int64_t i = wide_svo.size() - 1; i >= 0; --i) {
+    // The compact SVO stores nodes in reverse wide order, so the root is node 0 and
+    // siblings stay contiguous. Parents whose children are out of reach of a 15-bit
+    // offset get a far pointer slot placed right after their own sibling group. Slots
+    // push later nodes further apart, so repeat the layout until no new far pointers
+    // are needed.
+    uint64_t num_wide = wide_svo.size();
+    std::vector<uint8_t> group_size(num_wide, 0);
+    uint64_t expected_leaves = 0;
+    group_size[num_wide - 1] = 1;
+    for (uint64_t i = 0; i < num_wide; ++i) {
+	if (!wide_svo[i].leaf) {
+	    uint8_t num_valid = (uint8_t) std::bitset<8>(wide_svo[i].parent.valid_mask).count();
+	    group_size[wide_svo[i].parent.child_pointer] = num_valid;
+	    expected_leaves += std::bitset<8>(wide_svo[i].parent.leaf_mask).count();
+	}
+    }
+    std::vector<bool> far(num_wide, false);
+    std::vector<uint64_t> position(num_wide);
+    std::vector<uint64_t> far_slot(num_wide);
+    uint64_t svo_size;
+    bool layout_changed;
+    do {
+	layout_changed = false;
+	svo_size = 0;
+	for (uint64_t i = num_wide; i-- > 0;) {
+	    position[i] = svo_size++;
+	    for (uint64_t j = i; j < i + group_size[i]; ++j) {
+		if (far[j]) {
+		    far_slot[j] = svo_size++;
+		}
+	    }
+	}
+	for (uint64_t i = 0; i < num_wide; ++i) {
+	    if (!wide_svo[i].leaf && !far[i]) {
+		uint8_t num_valid = (uint8_t) std::bitset<8>(wide_svo[i].parent.valid_mask).count();
+		uint64_t first_child = wide_svo[i].parent.child_pointer + num_valid - 1;
+		if (position[first_child] - position[i] > SVO_NEAR_POINTER_LIMIT) {
+		    far[i] = true;
+		    layout_changed = true;
+		}
+	    }
+	}
+    } while (layout_changed);
+
+    std::vector<SVONode> svo(svo_size, EMPTY_SVO_NODE);
+    uint64_t num_far = 0;
+    for (uint64_t i = 0; i < num_wide; ++i) {
 	WideSVONode wide_node = wide_svo[i];
+	SVONode &node = svo[position[i]];
 	if (wide_node.leaf) {
-	    SVONode leaf_node;
-	    leaf_node.leaf_data = wide_node.leaf_data;
-	    svo.push_back(leaf_node);
+	    node.leaf_data = wide_node.leaf_data;
 	} else {
 	    WideSVONodeParent wide_parent_node = wide_node.parent;
-	    SVONode parent_node;
-	    parent_node.parent.valid_mask = reverse(wide_parent_node.valid_mask);
-	    parent_node.parent.leaf_mask = reverse(wide_parent_node.leaf_mask);
+	    node.parent.valid_mask = reverse(wide_parent_node.valid_mask);
+	    node.parent.leaf_mask = reverse(wide_parent_node.leaf_mask);
 	    uint8_t num_valid = (uint8_t) std::bitset<8>(wide_parent_node.valid_mask).count();
-	    uint64_t child_diff = i - wide_parent_node.child_pointer - num_valid + 1;
-	    parent_node.parent.child_pointer = child_diff & 0xFFFF; // TODO: add far pointer mechanism
-	    svo.push_back(parent_node);
+	    uint64_t child_diff = position[wide_parent_node.child_pointer + num_valid - 1] - position[i];
+	    if (far[i]) {
+		ASSERT(child_diff <= 0xFFFFFFFF, "ERROR: SVO is too large for 32-bit far pointers.");
+		node.parent.far = 1;
+		node.parent.child_pointer = (uint32_t) (far_slot[i] - position[i]) & SVO_NEAR_POINTER_LIMIT;
+		svo[far_slot[i]].far_pointer = (uint32_t) child_diff;
+		++num_far;
+	    } else {
+		node.parent.far = 0;
+		node.parent.child_pointer = (uint32_t) child_diff & SVO_NEAR_POINTER_LIMIT;
+	    }
 	}
     }
+    std::cout << "Compacted " << num_wide << " nodes into " << svo.size() << " words (" << num_far << " far pointers).\n";
+    ASSERT(validate_svo(svo, d_max_depth, expected_leaves), "ERROR: Compacted SVO failed validation.");
 
     dump_svo(svo);
 
-    output_file = std::string(argv[1]) + ".svo";
-    f = fopen(output_file.c_str(), "w");
-    ASSERT(f, "Couldn't open .svo file.");
-    fwrite(svo.data(), sizeof(SVONode), svo.size(), f);
-    fclose(f);
+    OutputFile svo_file = open_output_file(std::string(argv[1]) + ".svo", svo.size() * sizeof(SVONode));
+    write_output_file(svo_file, svo.data(), svo.size() * sizeof(SVONode));
+    close_output_file(svo_file);
 }